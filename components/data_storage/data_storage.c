@@ -14,6 +14,7 @@
 
 #include <water_timer.h>
 #include <data_storage.h>
+#include <task_topology.h>
 
 #define WATERING_DURATION_MULTIPLIER 1000
 #define MAX_HTTP_OUTPUT_BUFFER 2048
@@ -21,6 +22,7 @@
 static const char *TAG = "data_storage";
 static char output_buffer[MAX_HTTP_OUTPUT_BUFFER];
 static int output_len = 0;
+static water_stats_t stats_checkpoint;
 
 time_t incr_time = 0;
 
@@ -28,6 +30,50 @@ uint16_t days_interval = 0;
 uint16_t hours_interval = 0;
 uint64_t watering_duration = 5 * WATERING_DURATION_MULTIPLIER;
 
+#if CONFIG_WATER_CATCH_UP_SKIP
+catch_up_policy_t catch_up_policy = CATCH_UP_SKIP;
+#elif CONFIG_WATER_CATCH_UP_RUN_ONCE
+catch_up_policy_t catch_up_policy = CATCH_UP_RUN_ONCE;
+#else
+catch_up_policy_t catch_up_policy = CATCH_UP_WITHIN;
+#endif
+uint32_t catch_up_max_late = CONFIG_WATER_CATCH_UP_MAX_LATE_MIN * 60;
+
+bool config_loaded = false;
+
+static bool parse_catch_up(cJSON *catch_up_obj, catch_up_policy_t *policy, uint32_t *max_late)
+{
+    cJSON *policy_resp = cJSON_GetObjectItem(catch_up_obj, "Policy");
+    cJSON *max_late_resp = cJSON_GetObjectItem(catch_up_obj, "Max_Late_Minutes");
+
+    if (policy_resp == NULL || !cJSON_IsString(policy_resp)) {
+        ESP_LOGI(TAG, "Catch up policy not found or not a string");
+        return false;
+    }
+
+    if (strcmp(policy_resp->valuestring, "skip") == 0) {
+        *policy = CATCH_UP_SKIP;
+    } else if (strcmp(policy_resp->valuestring, "run_once") == 0) {
+        *policy = CATCH_UP_RUN_ONCE;
+    } else if (strcmp(policy_resp->valuestring, "within") == 0) {
+        *policy = CATCH_UP_WITHIN;
+    } else {
+        ESP_LOGI(TAG, "Unknown catch up policy %s", policy_resp->valuestring);
+        return false;
+    }
+
+    if (max_late_resp != NULL) {
+        if (!cJSON_IsNumber(max_late_resp) ||
+            max_late_resp->valuedouble < 0 || max_late_resp->valuedouble > UINT32_MAX / 60) {
+            ESP_LOGI(TAG, "Catch up max late is not a valid number");
+            return false;
+        }
+        *max_late = (uint32_t)max_late_resp->valueint * 60;
+    }
+
+    return true;
+}
+
 esp_err_t curr_time_http_handler(esp_http_client_event_t *evt) {
     switch (evt->event_id) {
         case HTTP_EVENT_ERROR:
@@ -272,7 +318,8 @@ void update_incr_time(void)
     ESP_LOGI(TAG, "CURR TIME -> %s", strftime_buf);
     ESP_LOGI(TAG, "INCR TIME -> %s", strftimeincr_buf);
 
-    while(now > incr_time) {
+    // A slot planned for this very second has just been handled as well, so it counts as due
+    while(now >= incr_time) {
         
         /*
         char post_data[256];
@@ -321,86 +368,111 @@ void update_incr_time(void)
     }
 }
 
-void save_new_time_data(char *buf, httpd_req_t *req)
+esp_err_t parse_time_data(const char *buf, size_t len, time_data_t *data)
 {
-
-    cJSON *response = cJSON_Parse(buf);
+    cJSON *response = cJSON_ParseWithLength(buf, len);
     if (response == NULL) {
         ESP_LOGI(TAG, "Failed to parse JSON");
+        return ESP_ERR_INVALID_ARG;
     }
 
     cJSON *watering_interval_obj = cJSON_GetObjectItem(response, "Watering_Interval");
+    cJSON *days_interval_resp = cJSON_GetObjectItem(watering_interval_obj, "Days");
+    cJSON *hours_interval_resp = cJSON_GetObjectItem(watering_interval_obj, "Hours");
+    cJSON *data_duration = cJSON_GetObjectItem(response, "Watering_Duration");
+    cJSON *catch_up_obj = cJSON_GetObjectItem(response, "Catch_Up");
+    char *duration_end;
+
     if (watering_interval_obj == NULL) {
         ESP_LOGI(TAG, "Watering_Interval object not found");
         cJSON_Delete(response);
+        return ESP_ERR_INVALID_ARG;
     }
 
-    cJSON *days_interval_resp = cJSON_GetObjectItem(watering_interval_obj, "Days");
-    cJSON *hours_interval_resp = cJSON_GetObjectItem(watering_interval_obj, "Hours");
-    cJSON *data_duration = cJSON_GetObjectItem(response, "Watering_Duration");
-
-    if (days_interval_resp == NULL || !cJSON_IsNumber(days_interval_resp)) {
-        ESP_LOGI(TAG, "Days data not found or not a number");
+    if (days_interval_resp == NULL || !cJSON_IsNumber(days_interval_resp) ||
+        days_interval_resp->valuedouble < 0 || days_interval_resp->valuedouble > UINT16_MAX) {
+        ESP_LOGI(TAG, "Days data not found or not a valid number");
         cJSON_Delete(response);
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (hours_interval_resp == NULL || !cJSON_IsNumber(hours_interval_resp)) {
-        ESP_LOGI(TAG, "Hours data not found or not a number");
+    if (hours_interval_resp == NULL || !cJSON_IsNumber(hours_interval_resp) ||
+        hours_interval_resp->valuedouble < 0 || hours_interval_resp->valuedouble > UINT16_MAX) {
+        ESP_LOGI(TAG, "Hours data not found or not a valid number");
         cJSON_Delete(response);
+        return ESP_ERR_INVALID_ARG;
     }
 
     if (data_duration == NULL || !cJSON_IsString(data_duration)) {
         ESP_LOGI(TAG, "Duration data not found or not a string");
         cJSON_Delete(response);
+        return ESP_ERR_INVALID_ARG;
     }
 
     ESP_LOGI(TAG, "DAYS DATA -> %d", days_interval_resp->valueint);
     ESP_LOGI(TAG, "HOURS DATA -> %d", hours_interval_resp->valueint);
     ESP_LOGI(TAG, "DURATION DATA -> %s", data_duration->valuestring);
 
-    uint16_t new_days_interval = (uint16_t)days_interval_resp->valueint;
-    uint16_t new_hours_interval = (uint16_t)hours_interval_resp->valueint;
-    uint64_t new_watering_duration = strtoull(data_duration->valuestring, NULL, 10);
+    data->days_interval = (uint16_t)days_interval_resp->valueint;
+    data->hours_interval = (uint16_t)hours_interval_resp->valueint;
+    data->watering_duration = strtoull(data_duration->valuestring, &duration_end, 10);
+    if (data_duration->valuestring[0] < '0' || data_duration->valuestring[0] > '9' || *duration_end != '\0' ||
+        data->watering_duration > UINT64_MAX / WATERING_DURATION_MULTIPLIER) {
+        ESP_LOGI(TAG, "Duration data is not a valid number");
+        cJSON_Delete(response);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    data->catch_up_policy = catch_up_policy;
+    data->catch_up_max_late = catch_up_max_late;
+    if (catch_up_obj != NULL && !parse_catch_up(catch_up_obj, &data->catch_up_policy, &data->catch_up_max_late)) {
+        cJSON_Delete(response);
+        return ESP_ERR_INVALID_ARG;
+    }
 
     cJSON_Delete(response);
+    return ESP_OK;
+}
 
-    days_interval = new_days_interval;
-    hours_interval = new_hours_interval;
-    watering_duration = new_watering_duration * WATERING_DURATION_MULTIPLIER;
+esp_err_t save_new_time_data(const time_data_t *data)
+{
+    days_interval = data->days_interval;
+    hours_interval = data->hours_interval;
+    watering_duration = data->watering_duration * WATERING_DURATION_MULTIPLIER;
+    catch_up_policy = data->catch_up_policy;
+    catch_up_max_late = data->catch_up_max_late;
 
     nvs_handle_t nvs_write_strg_handle;
     esp_err_t err = nvs_open("dataStrg", NVS_READWRITE, &nvs_write_strg_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
-        httpd_resp_sendstr(req, "Failed to open NVS handle");
+        return err;
     }
 
-    err = nvs_set_u16(nvs_write_strg_handle, "daysIntrv", new_days_interval);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set NVS value! Error: %s", esp_err_to_name(err));
-        nvs_close(nvs_write_strg_handle);
-        httpd_resp_sendstr(req, "Failed to set NVS value");
+    err = nvs_set_u16(nvs_write_strg_handle, "daysIntrv", data->days_interval);
+    if (err == ESP_OK) {
+        err = nvs_set_u16(nvs_write_strg_handle, "hoursIntrv", data->hours_interval);
     }
-
-    err = nvs_set_u16(nvs_write_strg_handle, "hoursIntrv", new_hours_interval);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set NVS value! Error: %s", esp_err_to_name(err));
-        nvs_close(nvs_write_strg_handle);
-        httpd_resp_sendstr(req, "Failed to set NVS value");
+    if (err == ESP_OK) {
+        err = nvs_set_u64(nvs_write_strg_handle, "waterDurat", watering_duration);
+    }
+    if (err == ESP_OK) {
+        err = nvs_set_u8(nvs_write_strg_handle, "catchUpPol", (uint8_t)data->catch_up_policy);
+    }
+    if (err == ESP_OK) {
+        err = nvs_set_u32(nvs_write_strg_handle, "catchUpMax", data->catch_up_max_late);
     }
-
-    err = nvs_set_u64(nvs_write_strg_handle, "waterDurat", watering_duration);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to set NVS value! Error: %s", esp_err_to_name(err));
         nvs_close(nvs_write_strg_handle);
-        httpd_resp_sendstr(req, "Failed to set NVS value");
+        return err;
     }
 
     err = nvs_commit(nvs_write_strg_handle);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to commit NVS! Error: %s", esp_err_to_name(err));
         nvs_close(nvs_write_strg_handle);
-        httpd_resp_sendstr(req, "Failed to commit NVS");
+        return err;
     }
 
     nvs_close(nvs_write_strg_handle);
@@ -408,12 +480,9 @@ void save_new_time_data(char *buf, httpd_req_t *req)
     ESP_LOGI(TAG, "Updated days interval to %" PRIu16, days_interval);
     ESP_LOGI(TAG, "Updated hours interval to %" PRIu16, hours_interval);
     ESP_LOGI(TAG, "Updated watering duration to %" PRIu64, watering_duration);
+    ESP_LOGI(TAG, "Updated catch up policy to %d, max late %" PRIu32 " s", catch_up_policy, catch_up_max_late);
 
-    ESP_LOGI(TAG, "message %s", buf);
-
-    httpd_resp_send_chunk(req, NULL, 0);
-
-    initialize_water_timer();
+    return ESP_OK;
 }
 
 void get_data_values(void)
@@ -478,6 +547,95 @@ void get_data_values(void)
             default:
                 ESP_LOGE(TAG, "Error (%s) reading!", esp_err_to_name(ret));
         }
+
+        size_t stats_size = sizeof(stats_checkpoint);
+        ret = nvs_get_blob(nvs_read_strg_handle, "waterStats", &stats_checkpoint, &stats_size);
+        switch (ret) {
+            case ESP_OK:
+                if (stats_size == sizeof(stats_checkpoint)) {
+                    water_stats_restore(&stats_checkpoint);
+                    ESP_LOGI(TAG, "Stored water stats restored");
+                } else {
+                    ESP_LOGW(TAG, "Stored water stats have the wrong size, ignoring.");
+                }
+                break;
+            case ESP_ERR_NVS_NOT_FOUND:
+                ESP_LOGI(TAG, "No stored water stats found, starting empty.");
+                break;
+            default:
+                ESP_LOGE(TAG, "Error (%s) reading!", esp_err_to_name(ret));
+        }
+
+        uint8_t stored_catch_up_policy = 0;
+        ret = nvs_get_u8(nvs_read_strg_handle, "catchUpPol", &stored_catch_up_policy);
+        switch (ret) {
+            case ESP_OK:
+                if (stored_catch_up_policy > CATCH_UP_WITHIN) {
+                    ESP_LOGW(TAG, "Stored catch up policy %u is invalid, using default.", stored_catch_up_policy);
+                    break;
+                }
+                catch_up_policy = (catch_up_policy_t)stored_catch_up_policy;
+                ESP_LOGI(TAG, "Stored catch up policy: %d", catch_up_policy);
+                break;
+            case ESP_ERR_NVS_NOT_FOUND:
+                ESP_LOGI(TAG, "No stored catch up policy found, using default.");
+                break;
+            default:
+                ESP_LOGE(TAG, "Error (%s) reading!", esp_err_to_name(ret));
+        }
+
+        uint32_t stored_catch_up_max_late = 0;
+        ret = nvs_get_u32(nvs_read_strg_handle, "catchUpMax", &stored_catch_up_max_late);
+        switch (ret) {
+            case ESP_OK:
+                catch_up_max_late = stored_catch_up_max_late;
+                ESP_LOGI(TAG, "Stored catch up max late: %" PRIu32, catch_up_max_late);
+                break;
+            case ESP_ERR_NVS_NOT_FOUND:
+                ESP_LOGI(TAG, "No stored catch up max late found, using default.");
+                break;
+            default:
+                ESP_LOGE(TAG, "Error (%s) reading!", esp_err_to_name(ret));
+        }
         nvs_close(nvs_read_strg_handle);
+
+        config_loaded = true;
     }
-}
\ No newline at end of file
+}
+
+static void storage_writer_task(void *arg)
+{
+    while(1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_WATER_STATS_CHECKPOINT_MIN * 60 * 1000));
+
+        if (!water_stats_snapshot(&stats_checkpoint)) continue;
+
+        nvs_handle_t nvs_write_strg_handle;
+        esp_err_t err = nvs_open("dataStrg", NVS_READWRITE, &nvs_write_strg_handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error (%s) opening NVS handle!", esp_err_to_name(err));
+            water_stats_mark_dirty();
+            continue;
+        }
+
+        err = nvs_set_blob(nvs_write_strg_handle, "waterStats", &stats_checkpoint, sizeof(stats_checkpoint));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_write_strg_handle);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to checkpoint water stats! Error: %s", esp_err_to_name(err));
+            // Retried at the next interval
+            water_stats_mark_dirty();
+        } else {
+            ESP_LOGI(TAG, "Water stats checkpointed");
+        }
+
+        nvs_close(nvs_write_strg_handle);
+    }
+}
+
+void start_storage_writer(void)
+{
+    task_topology_create(TASK_STORAGE, storage_writer_task, NULL);
+}
@@ -1,14 +1,35 @@
+#pragma once
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <esp_http_server.h>
 #include <esp_http_client.h>
 
+typedef enum {
+    CATCH_UP_SKIP = 0,
+    CATCH_UP_RUN_ONCE,
+    CATCH_UP_WITHIN,
+} catch_up_policy_t;
+
+typedef struct {
+    uint16_t days_interval;
+    uint16_t hours_interval;
+    uint64_t watering_duration;
+    catch_up_policy_t catch_up_policy;
+    uint32_t catch_up_max_late;
+} time_data_t;
+
 extern uint16_t days_interval;
 extern uint16_t hours_interval;
 extern uint64_t watering_duration;
 extern time_t incr_time;
+extern catch_up_policy_t catch_up_policy;
+extern uint32_t catch_up_max_late;
+extern bool config_loaded;
 
-void save_new_time_data(char *buf, httpd_req_t *req);
+esp_err_t parse_time_data(const char *buf, size_t len, time_data_t *data);
+esp_err_t save_new_time_data(const time_data_t *data);
 void update_curr_time(void);
 void get_data_values(void);
 void update_incr_time(void);
+void start_storage_writer(void);
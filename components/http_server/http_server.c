@@ -18,9 +18,18 @@
 #include <esp_netif.h>
 #include <esp_http_client.h>
 #include <esp_http_server.h>
-
+#include <esp_timer.h>
+#include <esp_mac.h>
+#include <esp_random.h>
+#include <esp_app_desc.h>
+#include <mdns.h>
+#include <lwip/sockets.h>
+
+#include <http_server.h>
 #include <data_storage.h>
 #include <water_timer.h>
+#include <task_topology.h>
+#include <ota_update.h>
 
 
 #define WIFI_SSID       CONFIG_ESP_WIFI_SSID
@@ -32,6 +41,14 @@
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 
+#define MDNS_SERVICE_TYPE  "_esplant"
+#define MDNS_SERVICE_PROTO "_tcp"
+
+#define MAX_UPDATE_BODY       512
+#define MAX_RECV_RETRIES      3
+#define MAX_ROUTES            12
+#define ROUTE_LATENCY_SAMPLES 32
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 static const char *TAG = "Http Server";
@@ -40,6 +57,186 @@ static int s_retry_num = 0;
 
 static EventGroupHandle_t s_wifi_event_group;
 
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t status_version = 0;
+
+typedef enum {
+    REQ_CLASS_READ = 0,
+    REQ_CLASS_WRITE,
+    REQ_CLASS_OTA,
+    REQ_CLASS_COUNT,
+} req_class_t;
+
+typedef struct {
+    esp_err_t (*handler)(httpd_req_t *req);
+    req_class_t req_class;
+    const char *uri;
+    uint32_t count;
+    uint32_t failed;
+    uint32_t max_us;
+    uint32_t latency_us[ROUTE_LATENCY_SAMPLES];
+} limited_route_t;
+
+typedef struct {
+    uint32_t addr;
+    int64_t last_seen;
+    int64_t refilled_at[REQ_CLASS_COUNT];
+    int32_t milli_tokens[REQ_CLASS_COUNT];
+} client_bucket_t;
+
+static const struct {
+    uint32_t rate_per_min;
+    uint32_t burst;
+} class_limits[REQ_CLASS_COUNT] = {
+    [REQ_CLASS_READ]  = { CONFIG_HTTP_READ_RATE_PER_MIN,  CONFIG_HTTP_READ_BURST },
+    [REQ_CLASS_WRITE] = { CONFIG_HTTP_WRITE_RATE_PER_MIN, CONFIG_HTTP_WRITE_BURST },
+    [REQ_CLASS_OTA]   = { CONFIG_HTTP_OTA_RATE_PER_MIN,   CONFIG_HTTP_OTA_BURST },
+};
+
+// Handlers and session callbacks all run on the single httpd task, so the
+// admission state needs no locking
+static client_bucket_t client_buckets[CONFIG_HTTP_RATE_LIMIT_CLIENTS];
+static uint32_t limited_count[REQ_CLASS_COUNT];
+static uint32_t rejected_count = 0;
+static uint32_t open_sessions = 0;
+static int accepted_fds[CONFIG_HTTP_MAX_IN_FLIGHT];
+static limited_route_t *routes[MAX_ROUTES];
+static int route_count = 0;
+
+static uint32_t client_addr(httpd_req_t *req) {
+    struct sockaddr_in6 addr;
+    socklen_t addr_len = sizeof(addr);
+    uint32_t ipv4 = 0;
+
+    if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &addr_len) < 0) {
+        return 0;
+    }
+
+    if (addr.sin6_family == AF_INET) {
+        return ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    }
+
+    // IPv4-mapped and link-local IPv6 peers are told apart by the low 32 bits
+    memcpy(&ipv4, &addr.sin6_addr.s6_addr[12], sizeof(ipv4));
+    return ipv4;
+}
+
+static client_bucket_t *find_client(uint32_t addr, int64_t now) {
+    client_bucket_t *oldest = &client_buckets[0];
+
+    for (int i = 0; i < CONFIG_HTTP_RATE_LIMIT_CLIENTS; i++) {
+        if (client_buckets[i].last_seen != 0 && client_buckets[i].addr == addr) {
+            return &client_buckets[i];
+        }
+        if (client_buckets[i].last_seen < oldest->last_seen) {
+            oldest = &client_buckets[i];
+        }
+    }
+
+    oldest->addr = addr;
+    for (int c = 0; c < REQ_CLASS_COUNT; c++) {
+        oldest->milli_tokens[c] = class_limits[c].burst * 1000;
+        oldest->refilled_at[c] = now;
+    }
+
+    return oldest;
+}
+
+// Returns 0 when a token was taken, otherwise the seconds until one is available
+static uint32_t take_token(uint32_t addr, req_class_t req_class) {
+    int64_t now = esp_timer_get_time();
+    client_bucket_t *client = find_client(addr, now);
+    int32_t capacity = class_limits[req_class].burst * 1000;
+
+    client->last_seen = now;
+
+    int64_t refill = (now - client->refilled_at[req_class]) * class_limits[req_class].rate_per_min / 60000;
+    if (refill > 0) {
+        client->milli_tokens[req_class] = MIN(capacity, client->milli_tokens[req_class] + refill);
+        client->refilled_at[req_class] = now;
+    }
+
+    if (client->milli_tokens[req_class] >= 1000) {
+        client->milli_tokens[req_class] -= 1000;
+        return 0;
+    }
+
+    uint32_t missing = 1000 - client->milli_tokens[req_class];
+    return (missing * 60 + class_limits[req_class].rate_per_min * 1000 - 1) / (class_limits[req_class].rate_per_min * 1000);
+}
+
+static esp_err_t limited_handler(httpd_req_t *req) {
+    limited_route_t *route = req->user_ctx;
+
+    uint32_t retry_after = take_token(client_addr(req), route->req_class);
+    if (retry_after > 0) {
+        char retry_str[11];
+
+        limited_count[route->req_class]++;
+        ESP_LOGW(TAG, "Rate limited %s, retry after %" PRIu32 " s", req->uri, retry_after);
+
+        snprintf(retry_str, sizeof(retry_str), "%" PRIu32, retry_after);
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_set_hdr(req, "Retry-After", retry_str);
+        httpd_resp_sendstr(req, "Too Many Requests");
+        return ESP_OK;
+    }
+
+    int64_t started = esp_timer_get_time();
+    esp_err_t err = route->handler(req);
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - started);
+
+    route->latency_us[route->count % ROUTE_LATENCY_SAMPLES] = elapsed;
+    route->count++;
+    if (err != ESP_OK) route->failed++;
+    if (elapsed > route->max_us) route->max_us = elapsed;
+
+    return err;
+}
+
+static void register_limited_uri(httpd_handle_t server, const httpd_uri_t *uri) {
+    limited_route_t *route = uri->user_ctx;
+
+    if (httpd_register_uri_handler(server, uri) != ESP_OK || route_count >= MAX_ROUTES) {
+        return;
+    }
+
+    route->uri = uri->uri;
+    routes[route_count++] = route;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static esp_err_t session_open(httpd_handle_t hd, int sockfd) {
+    for (int i = 0; i < CONFIG_HTTP_MAX_IN_FLIGHT; i++) {
+        if (accepted_fds[i] < 0) {
+            accepted_fds[i] = sockfd;
+            open_sessions++;
+            return ESP_OK;
+        }
+    }
+
+    rejected_count++;
+    ESP_LOGW(TAG, "Rejecting connection, %" PRIu32 " already open", open_sessions);
+    return ESP_FAIL;
+}
+
+static void session_close(httpd_handle_t hd, int sockfd) {
+    // close_fn also runs for sockets session_open() rejected, only accepted ones are counted
+    for (int i = 0; i < CONFIG_HTTP_MAX_IN_FLIGHT; i++) {
+        if (accepted_fds[i] == sockfd) {
+            accepted_fds[i] = -1;
+            open_sessions--;
+            break;
+        }
+    }
+    close(sockfd);
+}
+
 esp_err_t get_handler(httpd_req_t *req) {
     const char response[] = "Pinged Back From ESP-Plant";
     httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
@@ -47,11 +244,30 @@ esp_err_t get_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+esp_err_t send_json(httpd_req_t *req, cJSON *root, const char *name) {
+    char *response = root ? cJSON_PrintUnformatted(root) : NULL;
+    cJSON_Delete(root);
+
+    if (response == NULL) {
+        ESP_LOGE(TAG, "Out of memory building %s response", name);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, response, HTTPD_RESP_USE_STRLEN);
+    ESP_LOGI(TAG, "%s REQUESTED: %s", name, response);
+    free(response);
+    return ESP_OK;
+}
+
+static limited_route_t route_get = { get_handler, REQ_CLASS_READ };
+
 httpd_uri_t uri_get = {
     .uri      = "/",
     .method   = HTTP_GET,
-    .handler  = get_handler,
-    .user_ctx = NULL
+    .handler  = limited_handler,
+    .user_ctx = &route_get
 };
 
 esp_err_t get_time_left_handler(httpd_req_t *req) {
@@ -63,11 +279,13 @@ esp_err_t get_time_left_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+static limited_route_t route_get_time_left = { get_time_left_handler, REQ_CLASS_READ };
+
 httpd_uri_t uri_get_time_left = {
     .uri      = "/time_left",
     .method   = HTTP_GET,
-    .handler  = get_time_left_handler,
-    .user_ctx = NULL
+    .handler  = limited_handler,
+    .user_ctx = &route_get_time_left
 };
 
 esp_err_t get_watering_interval_handler(httpd_req_t *req) {
@@ -79,52 +297,350 @@ esp_err_t get_watering_interval_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+static limited_route_t route_get_watering_interval = { get_watering_interval_handler, REQ_CLASS_READ };
+
 httpd_uri_t uri_get_watering_interval = {
     .uri      = "/watering_interval",
     .method   = HTTP_GET,
-    .handler  = get_watering_interval_handler,
-    .user_ctx = NULL
+    .handler  = limited_handler,
+    .user_ctx = &route_get_watering_interval
 };
 
 esp_err_t post_update_data_handler(httpd_req_t *req) {
-    stop_timers();
-
-    char buf[200];
-    int ret, remaining = req->content_len;
+    char buf[MAX_UPDATE_BODY + 1];
+    int ret, received = 0, retries = 0;
+    time_data_t data;
+
+    if (req->content_len > MAX_UPDATE_BODY) {
+        ESP_LOGW(TAG, "Update data body too large: %d", (int)req->content_len);
+        httpd_resp_set_status(req, "413 Content Too Large");
+        httpd_resp_sendstr(req, "Body too large");
+        return ESP_FAIL;
+    }
 
-    while (remaining > 0) {
-        if ((ret = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)))) <= 0) {
-            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+    while (received < req->content_len) {
+        if ((ret = httpd_req_recv(req, buf + received, req->content_len - received)) <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= MAX_RECV_RETRIES) {
                 /* Retry receiving if timeout occurred */
                 continue;
             }
             return ESP_FAIL;
         }
-        httpd_resp_send_chunk(req, buf, ret);
-        remaining -= ret;
+        received += ret;
+    }
+    buf[received] = '\0';
+
+    ESP_LOGI(TAG, "message %s", buf);
+
+    if (parse_time_data(buf, received, &data) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid watering data");
+        return ESP_OK;
     }
 
-    save_new_time_data(buf, req);
+    if (!stop_timers()) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_sendstr(req, "Scheduler busy");
+        return ESP_OK;
+    }
+    esp_err_t err = save_new_time_data(&data);
+    initialize_water_timer();
+
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store watering data");
+        return ESP_OK;
+    }
+
+    publish_status_change();
+
+    httpd_resp_send(req, buf, received);
 
     return ESP_OK;
 }
 
+static limited_route_t route_post_update_data = { post_update_data_handler, REQ_CLASS_WRITE };
+
 httpd_uri_t uri_post_update_data = {
     .uri      = "/update_data",
     .method   = HTTP_POST,
-    .handler  = post_update_data_handler,
-    .user_ctx = NULL
+    .handler  = limited_handler,
+    .user_ctx = &route_post_update_data
+};
+
+esp_err_t get_lateness_handler(httpd_req_t *req) {
+    lateness_stats_t stats;
+    get_lateness_stats(&stats);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "samples", stats.samples);
+    cJSON_AddNumberToObject(root, "max_ms", stats.max_ms);
+    cJSON_AddNumberToObject(root, "p50_ms", stats.p50_ms);
+    cJSON_AddNumberToObject(root, "p99_ms", stats.p99_ms);
+    cJSON_AddNumberToObject(root, "missed", stats.missed);
+    cJSON_AddNumberToObject(root, "caught_up", stats.caught_up);
+
+    cJSON *last = cJSON_AddObjectToObject(root, "last");
+    cJSON_AddNumberToObject(last, "planned", stats.last.planned);
+    cJSON_AddNumberToObject(last, "started", stats.last.started);
+    cJSON_AddNumberToObject(last, "lateness_ms", stats.last.lateness_ms);
+    cJSON_AddBoolToObject(last, "caught_up", stats.last.caught_up);
+
+    return send_json(req, root, "Lateness");
+}
+
+static limited_route_t route_get_lateness = { get_lateness_handler, REQ_CLASS_READ };
+
+httpd_uri_t uri_get_lateness = {
+    .uri      = "/lateness",
+    .method   = HTTP_GET,
+    .handler  = limited_handler,
+    .user_ctx = &route_get_lateness
+};
+
+esp_err_t get_tasks_handler(httpd_req_t *req) {
+    cJSON *root = cJSON_CreateArray();
+
+    for (int i = 0; i < TASK_COUNT; i++) {
+        cJSON *task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", task_topology[i].name);
+        cJSON_AddNumberToObject(task, "core", task_topology[i].core_id == tskNO_AFFINITY ? -1 : task_topology[i].core_id);
+        cJSON_AddNumberToObject(task, "priority", task_topology[i].priority);
+        cJSON_AddNumberToObject(task, "stack_size", task_topology[i].stack_size);
+        cJSON_AddNumberToObject(task, "stack_free", task_topology_stack_free(i));
+        cJSON_AddBoolToObject(task, "static_stack", task_topology[i].stack != NULL);
+        cJSON_AddItemToArray(root, task);
+    }
+
+    return send_json(req, root, "Tasks");
+}
+
+static limited_route_t route_get_tasks = { get_tasks_handler, REQ_CLASS_READ };
+
+httpd_uri_t uri_get_tasks = {
+    .uri      = "/tasks",
+    .method   = HTTP_GET,
+    .handler  = limited_handler,
+    .user_ctx = &route_get_tasks
+};
+
+static cJSON *bucket_json(const water_bucket_t *bucket) {
+    cJSON *obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "count", bucket->count);
+    cJSON_AddNumberToObject(obj, "open_seconds", bucket->open_ms / 1000);
+    cJSON_AddNumberToObject(obj, "volume_ml", bucket->volume_ml);
+    return obj;
+}
+
+static const char *period_names[WATER_PERIOD_COUNT] = { "hour", "day", "week", "month" };
+
+static int parse_period(httpd_req_t *req) {
+    char query[32], value[8];
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "period", value, sizeof(value)) != ESP_OK) {
+        return WATER_PERIOD_COUNT;
+    }
+
+    for (int p = 0; p < WATER_PERIOD_COUNT; p++) {
+        if (strcmp(value, period_names[p]) == 0) return p;
+    }
+    return -1;
+}
+
+esp_err_t get_stats_handler(httpd_req_t *req) {
+    static water_bucket_t history[WATER_STATS_MAX_HISTORY];
+    water_bucket_t bucket;
+
+    int period = parse_period(req);
+    if (period < 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "period must be hour, day, week or month");
+        return ESP_FAIL;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON *zones = cJSON_AddArrayToObject(root, "zones");
+
+    for (uint8_t zone = 0; zone < WATER_ZONE_COUNT; zone++) {
+        cJSON *zone_obj = cJSON_CreateObject();
+        cJSON_AddNumberToObject(zone_obj, "zone", zone);
+
+        if (period < WATER_PERIOD_COUNT) {
+            // Full ring for one period, newest first
+            int n = water_stats_history(zone, period, history, WATER_STATS_MAX_HISTORY);
+            cJSON *ring = cJSON_AddArrayToObject(zone_obj, period_names[period]);
+            for (int i = 0; i < n; i++) {
+                cJSON_AddItemToArray(ring, bucket_json(&history[i]));
+            }
+        } else {
+            for (int p = 0; p < WATER_PERIOD_COUNT; p++) {
+                water_stats_current(zone, p, &bucket);
+                cJSON_AddItemToObject(zone_obj, period_names[p], bucket_json(&bucket));
+            }
+
+            water_stats_total(zone, &bucket);
+            cJSON_AddItemToObject(zone_obj, "total", bucket_json(&bucket));
+        }
+
+        cJSON_AddItemToArray(zones, zone_obj);
+    }
+
+    return send_json(req, root, "Stats");
+}
+
+static limited_route_t route_get_stats = { get_stats_handler, REQ_CLASS_READ };
+
+httpd_uri_t uri_get_stats = {
+    .uri      = "/stats",
+    .method   = HTTP_GET,
+    .handler  = limited_handler,
+    .user_ctx = &route_get_stats
+};
+
+static void start_mdns(uint16_t port) {
+    uint8_t mac[6];
+    char hostname[32];
+    char device_id[13];
+    char zones[4];
+    char version[11];
+    char port_str[6];
+
+    // Random start so a reboot never repeats a version a client already saw (Wi-Fi is up, so the RNG is seeded)
+    taskENTER_CRITICAL(&status_lock);
+    status_version = esp_random();
+    uint32_t current = status_version;
+    taskEXIT_CRITICAL(&status_lock);
+
+    esp_err_t err = mdns_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mDNS init failed: %s", esp_err_to_name(err));
+        return;
+    }
+
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(device_id, sizeof(device_id), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    snprintf(hostname, sizeof(hostname), "%s-%02x%02x%02x", CONFIG_ESPLANT_MDNS_HOSTNAME, mac[3], mac[4], mac[5]);
+    snprintf(zones, sizeof(zones), "%d", WATER_ZONE_COUNT);
+    snprintf(version, sizeof(version), "%" PRIu32, current);
+    snprintf(port_str, sizeof(port_str), "%" PRIu16, port);
+
+    mdns_hostname_set(hostname);
+    mdns_instance_name_set(CONFIG_ESPLANT_MDNS_INSTANCE);
+
+    mdns_txt_item_t txt[] = {
+        { "id",    device_id },
+        { "fw",    esp_app_get_description()->version },
+        { "zones", zones },
+        { "sv",    version },
+        { "port",  port_str },
+    };
+
+    err = mdns_service_add(NULL, MDNS_SERVICE_TYPE, MDNS_SERVICE_PROTO, port, txt, sizeof(txt) / sizeof(txt[0]));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mDNS service add failed: %s", esp_err_to_name(err));
+        return;
+    }
+
+    ESP_LOGI(TAG, "Advertising %s.local as %s.%s on port %" PRIu16, hostname, MDNS_SERVICE_TYPE, MDNS_SERVICE_PROTO, port);
+}
+
+void publish_status_change(void) {
+    char version[11];
+
+    taskENTER_CRITICAL(&status_lock);
+    uint32_t current = ++status_version;
+    taskEXIT_CRITICAL(&status_lock);
+
+    snprintf(version, sizeof(version), "%" PRIu32, current);
+    mdns_service_txt_item_set(MDNS_SERVICE_TYPE, MDNS_SERVICE_PROTO, "sv", version);
+}
+
+esp_err_t get_http_stats_handler(httpd_req_t *req) {
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "open_sessions", open_sessions);
+    cJSON_AddNumberToObject(root, "rejected", rejected_count);
+    cJSON_AddNumberToObject(root, "limited_read", limited_count[REQ_CLASS_READ]);
+    cJSON_AddNumberToObject(root, "limited_write", limited_count[REQ_CLASS_WRITE]);
+    cJSON_AddNumberToObject(root, "limited_ota", limited_count[REQ_CLASS_OTA]);
+
+    cJSON *route_stats = cJSON_AddArrayToObject(root, "routes");
+    for (int i = 0; i < route_count; i++) {
+        uint32_t sorted[ROUTE_LATENCY_SAMPLES];
+        uint32_t n = MIN(routes[i]->count, ROUTE_LATENCY_SAMPLES);
+
+        memcpy(sorted, routes[i]->latency_us, n * sizeof(sorted[0]));
+        qsort(sorted, n, sizeof(sorted[0]), compare_latency);
+
+        cJSON *route = cJSON_CreateObject();
+        cJSON_AddStringToObject(route, "uri", routes[i]->uri);
+        cJSON_AddNumberToObject(route, "count", routes[i]->count);
+        cJSON_AddNumberToObject(route, "failed", routes[i]->failed);
+        cJSON_AddNumberToObject(route, "p50_us", n ? sorted[(n - 1) * 50 / 100] : 0);
+        cJSON_AddNumberToObject(route, "p99_us", n ? sorted[(n - 1) * 99 / 100] : 0);
+        cJSON_AddNumberToObject(route, "max_us", routes[i]->max_us);
+        cJSON_AddItemToArray(route_stats, route);
+    }
+
+    return send_json(req, root, "Http Stats");
+}
+
+static limited_route_t route_get_http_stats = { get_http_stats_handler, REQ_CLASS_READ };
+
+httpd_uri_t uri_get_http_stats = {
+    .uri      = "/http_stats",
+    .method   = HTTP_GET,
+    .handler  = limited_handler,
+    .user_ctx = &route_get_http_stats
+};
+
+static limited_route_t route_post_ota = { post_ota_handler, REQ_CLASS_OTA };
+
+httpd_uri_t uri_post_ota = {
+    .uri      = "/ota",
+    .method   = HTTP_POST,
+    .handler  = limited_handler,
+    .user_ctx = &route_post_ota
+};
+
+static limited_route_t route_get_ota = { get_ota_handler, REQ_CLASS_READ };
+
+httpd_uri_t uri_get_ota = {
+    .uri      = "/ota",
+    .method   = HTTP_GET,
+    .handler  = limited_handler,
+    .user_ctx = &route_get_ota
 };
 
 httpd_handle_t setup_server(void) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     httpd_handle_t server = NULL;
 
+    config.task_priority = task_topology[TASK_HTTPD].priority;
+    config.stack_size = task_topology[TASK_HTTPD].stack_size;
+    config.core_id = task_topology[TASK_HTTPD].core_id;
+
+    // One spare socket so connections over the cap are accepted, counted and closed
+    config.max_open_sockets = CONFIG_HTTP_MAX_IN_FLIGHT + 1;
+    config.open_fn = session_open;
+    config.close_fn = session_close;
+    config.max_uri_handlers = MAX_ROUTES;
+
+    for (int i = 0; i < CONFIG_HTTP_MAX_IN_FLIGHT; i++) {
+        accepted_fds[i] = -1;
+    }
+
     if (httpd_start(&server, &config) == ESP_OK) {
-        httpd_register_uri_handler(server, &uri_get);
-        httpd_register_uri_handler(server, &uri_get_time_left);
-        httpd_register_uri_handler(server, &uri_get_watering_interval);
-        httpd_register_uri_handler(server, &uri_post_update_data);
+        register_limited_uri(server, &uri_get);
+        register_limited_uri(server, &uri_get_time_left);
+        register_limited_uri(server, &uri_get_watering_interval);
+        register_limited_uri(server, &uri_post_update_data);
+        register_limited_uri(server, &uri_get_lateness);
+        register_limited_uri(server, &uri_get_tasks);
+        register_limited_uri(server, &uri_get_stats);
+        register_limited_uri(server, &uri_get_http_stats);
+        register_limited_uri(server, &uri_post_ota);
+        register_limited_uri(server, &uri_get_ota);
+
+        start_mdns(config.server_port);
     }
 
     return server;
@@ -213,6 +729,4 @@ void setup_wifi(void) {
     update_curr_time();
 
     get_data_values();
-
-    update_incr_time();
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
+#pragma once
+
 #include <esp_http_server.h>
 #include <esp_http_client.h>
+#include <cJSON.h>
 
 void setup_wifi(void);
 httpd_handle_t setup_server(void);
+void publish_status_change(void);
+esp_err_t send_json(httpd_req_t *req, cJSON *root, const char *name);
 
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <esp_http_server.h>
+
+esp_err_t post_ota_handler(httpd_req_t *req);
+esp_err_t get_ota_handler(httpd_req_t *req);
+void start_ota_health_check(void);
@@ -0,0 +1,297 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp_ota_ops.h>
+#include <esp_app_desc.h>
+#include <mbedtls/sha256.h>
+#include <cJSON.h>
+
+#include <ota_update.h>
+#include <http_server.h>
+#include <water_timer.h>
+#include <data_storage.h>
+
+#define SHA256_LEN              32
+#define HEALTH_CHECK_PERIOD_US  (1000 * 1000)
+#define RESTART_CHECK_PERIOD_US (1000 * 1000)
+#define MAX_RECV_RETRIES        3
+
+static const char *TAG = "OTA Update";
+
+// One upload at a time, kept across connections so a dropped transfer can resume
+typedef struct {
+    bool active;
+    const esp_partition_t *partition;
+    esp_ota_handle_t handle;
+    mbedtls_sha256_context sha;
+    uint8_t expected_sha[SHA256_LEN];
+    uint32_t offset;
+    uint32_t total;
+} ota_session_t;
+
+static ota_session_t session;
+static char recv_buf[CONFIG_OTA_RECV_BUFFER_SIZE];
+
+static esp_timer_handle_t health_timer;
+static esp_timer_handle_t restart_timer;
+static int64_t health_deadline;
+
+static bool parse_sha256(const char *hex, uint8_t *out)
+{
+    if (strlen(hex) != SHA256_LEN * 2) return false;
+
+    for (int i = 0; i < SHA256_LEN; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1) return false;
+        out[i] = (uint8_t)byte;
+    }
+
+    return true;
+}
+
+static void reset_session(void)
+{
+    if (session.active) {
+        esp_ota_abort(session.handle);
+        mbedtls_sha256_free(&session.sha);
+    }
+    memset(&session, 0, sizeof(session));
+}
+
+static esp_err_t begin_session(const uint8_t *expected_sha, uint32_t total)
+{
+    reset_session();
+
+    session.partition = esp_ota_get_next_update_partition(NULL);
+    if (session.partition == NULL) {
+        ESP_LOGE(TAG, "No OTA partition available");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (total > session.partition->size) {
+        ESP_LOGE(TAG, "Image of %" PRIu32 " bytes does not fit partition %s", total, session.partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Sequential writes erase sector by sector, so the scheduler is never stalled by a full erase
+    esp_err_t err = esp_ota_begin(session.partition, OTA_WITH_SEQUENTIAL_WRITES, &session.handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    mbedtls_sha256_init(&session.sha);
+    mbedtls_sha256_starts(&session.sha, 0);
+    memcpy(session.expected_sha, expected_sha, SHA256_LEN);
+    session.total = total;
+    session.offset = 0;
+    session.active = true;
+
+    ESP_LOGI(TAG, "Writing %" PRIu32 " bytes to partition %s", total, session.partition->label);
+    return ESP_OK;
+}
+
+static void send_progress(httpd_req_t *req, const char *status)
+{
+    char body[64];
+
+    snprintf(body, sizeof(body), "{\"offset\":%" PRIu32 ",\"total\":%" PRIu32 "}", session.offset, session.total);
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, body);
+}
+
+static void restart_when_idle(void *arg)
+{
+    if (water_timer_busy()) {
+        ESP_LOGI(TAG, "Watering in progress, delaying restart");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Restarting into the new firmware");
+    esp_restart();
+}
+
+static esp_err_t finish_session(httpd_req_t *req)
+{
+    uint8_t sha[SHA256_LEN];
+
+    mbedtls_sha256_finish(&session.sha, sha);
+    mbedtls_sha256_free(&session.sha);
+
+    if (memcmp(sha, session.expected_sha, SHA256_LEN) != 0) {
+        ESP_LOGE(TAG, "SHA-256 mismatch, discarding image");
+        esp_ota_abort(session.handle);
+        memset(&session, 0, sizeof(session));
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "SHA-256 mismatch");
+        return ESP_OK;
+    }
+
+    esp_err_t err = esp_ota_end(session.handle);
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(session.partition);
+    }
+    memset(&session, 0, sizeof(session));
+
+    if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+        ESP_LOGE(TAG, "Image is not signed with the project key");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image verification failed");
+        return ESP_OK;
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to activate image: %s", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Image rejected");
+        return ESP_OK;
+    }
+
+    httpd_resp_sendstr(req, "Update complete, restarting");
+
+    const esp_timer_create_args_t restart_timer_args = {
+        .callback = &restart_when_idle,
+        .name = "ota_restart",
+    };
+    if (restart_timer == NULL) {
+        ESP_ERROR_CHECK(esp_timer_create(&restart_timer_args, &restart_timer));
+        ESP_ERROR_CHECK(esp_timer_start_periodic(restart_timer, RESTART_CHECK_PERIOD_US));
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t post_ota_handler(httpd_req_t *req)
+{
+    char header[80];
+    uint8_t expected_sha[SHA256_LEN];
+    uint32_t start = 0, end = 0, total = req->content_len;
+
+    // The staged image sits in the next update partition until the restart, a new upload would overwrite it
+    if (restart_timer != NULL) {
+        httpd_resp_set_status(req, "409 Conflict");
+        httpd_resp_sendstr(req, "Update already staged, waiting to restart");
+        return ESP_FAIL;
+    }
+
+    if (httpd_req_get_hdr_value_str(req, "X-Firmware-SHA256", header, sizeof(header)) != ESP_OK ||
+        !parse_sha256(header, expected_sha)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid X-Firmware-SHA256");
+        return ESP_FAIL;
+    }
+
+    if (httpd_req_get_hdr_value_str(req, "Content-Range", header, sizeof(header)) == ESP_OK) {
+        if (sscanf(header, "bytes %" SCNu32 "-%" SCNu32 "/%" SCNu32, &start, &end, &total) != 3 ||
+            end < start || end >= total || end - start + 1 != req->content_len) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid Content-Range");
+            return ESP_FAIL;
+        }
+    }
+
+    if (total == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty image");
+        return ESP_FAIL;
+    }
+
+    if (start == 0) {
+        if (begin_session(expected_sha, total) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start update");
+            return ESP_FAIL;
+        }
+    } else if (!session.active || start != session.offset || total != session.total ||
+               memcmp(expected_sha, session.expected_sha, SHA256_LEN) != 0) {
+        ESP_LOGW(TAG, "Resume at %" PRIu32 " does not match session offset %" PRIu32, start, session.offset);
+        // The body still carries the offset to resume from
+        snprintf(header, sizeof(header), "bytes */%" PRIu32, session.active ? session.total : total);
+        httpd_resp_set_hdr(req, "Content-Range", header);
+        send_progress(req, "416 Range Not Satisfiable");
+        return ESP_FAIL;
+    }
+
+    uint32_t remaining = req->content_len;
+    int retries = 0;
+    while (remaining > 0) {
+        int ret = httpd_req_recv(req, recv_buf, remaining < sizeof(recv_buf) ? remaining : sizeof(recv_buf));
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= MAX_RECV_RETRIES) {
+                continue;
+            }
+            // Keep the session, the client can resume from session.offset
+            ESP_LOGW(TAG, "Connection dropped at %" PRIu32 " of %" PRIu32, session.offset, session.total);
+            return ESP_FAIL;
+        }
+
+        esp_err_t err = esp_ota_write(session.handle, recv_buf, ret);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_ota_write failed: %s", esp_err_to_name(err));
+            reset_session();
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Flash write failed");
+            return ESP_FAIL;
+        }
+
+        mbedtls_sha256_update(&session.sha, (const unsigned char *)recv_buf, ret);
+        session.offset += ret;
+        remaining -= ret;
+    }
+
+    if (session.offset < session.total) {
+        send_progress(req, "202 Accepted");
+        return ESP_OK;
+    }
+
+    return finish_session(req);
+}
+
+esp_err_t get_ota_handler(httpd_req_t *req)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state = ESP_OTA_IMG_UNDEFINED;
+    esp_ota_get_state_partition(running, &state);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", esp_app_get_description()->version);
+    cJSON_AddStringToObject(root, "partition", running->label);
+    cJSON_AddBoolToObject(root, "pending_verify", state == ESP_OTA_IMG_PENDING_VERIFY);
+    cJSON_AddBoolToObject(root, "active", session.active);
+    cJSON_AddNumberToObject(root, "offset", session.offset);
+    cJSON_AddNumberToObject(root, "total", session.total);
+
+    return send_json(req, root, "OTA");
+}
+
+static void check_health(void *arg)
+{
+    if (config_loaded && water_timer_running()) {
+        ESP_LOGI(TAG, "New firmware is healthy, cancelling rollback");
+        esp_ota_mark_app_valid_cancel_rollback();
+        esp_timer_stop(health_timer);
+        return;
+    }
+
+    if (esp_timer_get_time() > health_deadline) {
+        ESP_LOGE(TAG, "New firmware not healthy after %d s, rolling back", CONFIG_OTA_HEALTH_DEADLINE_S);
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+void start_ota_health_check(void)
+{
+    esp_ota_img_states_t state;
+
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Running new firmware, waiting up to %d s for it to become healthy", CONFIG_OTA_HEALTH_DEADLINE_S);
+
+    health_deadline = esp_timer_get_time() + (int64_t)CONFIG_OTA_HEALTH_DEADLINE_S * 1000 * 1000;
+
+    const esp_timer_create_args_t health_timer_args = {
+        .callback = &check_health,
+        .name = "ota_health",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&health_timer_args, &health_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(health_timer, HEALTH_CHECK_PERIOD_US));
+}
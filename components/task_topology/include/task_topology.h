@@ -0,0 +1,28 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+typedef enum {
+    TASK_SCHEDULER = 0,
+    TASK_ACTUATOR,
+    TASK_HTTPD,
+    TASK_STORAGE,
+    TASK_COUNT,
+} task_id_t;
+
+typedef struct {
+    const char *name;
+    uint32_t stack_size;
+    UBaseType_t priority;
+    BaseType_t core_id;
+    StackType_t *stack;     // NULL when the task owner allocates the stack
+    StaticTask_t *tcb;
+    TaskHandle_t handle;
+} task_topology_entry_t;
+
+extern task_topology_entry_t task_topology[TASK_COUNT];
+
+TaskHandle_t task_topology_create(task_id_t id, TaskFunction_t task, void *arg);
+uint32_t task_topology_stack_free(task_id_t id);
+void task_topology_log(void);
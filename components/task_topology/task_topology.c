@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+
+#include <task_topology.h>
+
+#define TOPOLOGY_CORE(core) ((core) < 0 || (core) >= portNUM_PROCESSORS ? tskNO_AFFINITY : (core))
+
+static const char *TAG = "Task Topology";
+
+static StackType_t scheduler_stack[CONFIG_TASK_SCHEDULER_STACK_SIZE];
+static StaticTask_t scheduler_tcb;
+
+static StackType_t actuator_stack[CONFIG_TASK_ACTUATOR_STACK_SIZE];
+static StaticTask_t actuator_tcb;
+
+static StackType_t storage_stack[CONFIG_TASK_STORAGE_STACK_SIZE];
+static StaticTask_t storage_tcb;
+
+task_topology_entry_t task_topology[TASK_COUNT] = {
+    [TASK_SCHEDULER] = {
+        .name       = "Time Left",
+        .stack_size = CONFIG_TASK_SCHEDULER_STACK_SIZE,
+        .priority   = CONFIG_TASK_SCHEDULER_PRIORITY,
+        .core_id    = TOPOLOGY_CORE(CONFIG_TASK_SCHEDULER_CORE),
+        .stack      = scheduler_stack,
+        .tcb        = &scheduler_tcb,
+    },
+    [TASK_ACTUATOR] = {
+        .name       = "Actuator",
+        .stack_size = CONFIG_TASK_ACTUATOR_STACK_SIZE,
+        .priority   = CONFIG_TASK_ACTUATOR_PRIORITY,
+        .core_id    = TOPOLOGY_CORE(CONFIG_TASK_ACTUATOR_CORE),
+        .stack      = actuator_stack,
+        .tcb        = &actuator_tcb,
+    },
+    [TASK_HTTPD] = {
+        .name       = "httpd",
+        .stack_size = CONFIG_TASK_HTTPD_STACK_SIZE,
+        .priority   = CONFIG_TASK_HTTPD_PRIORITY,
+        .core_id    = TOPOLOGY_CORE(CONFIG_TASK_HTTPD_CORE),
+    },
+    [TASK_STORAGE] = {
+        .name       = "Storage",
+        .stack_size = CONFIG_TASK_STORAGE_STACK_SIZE,
+        .priority   = CONFIG_TASK_STORAGE_PRIORITY,
+        .core_id    = TOPOLOGY_CORE(CONFIG_TASK_STORAGE_CORE),
+        .stack      = storage_stack,
+        .tcb        = &storage_tcb,
+    },
+};
+
+TaskHandle_t task_topology_create(task_id_t id, TaskFunction_t task, void *arg)
+{
+    task_topology_entry_t *entry = &task_topology[id];
+
+    if (entry->handle != NULL) {
+        return entry->handle;
+    }
+
+    entry->handle = xTaskCreateStaticPinnedToCore(
+                        task,
+                        entry->name,
+                        entry->stack_size,
+                        arg,
+                        entry->priority,
+                        entry->stack,
+                        entry->tcb,
+                        entry->core_id
+                    );
+
+    return entry->handle;
+}
+
+uint32_t task_topology_stack_free(task_id_t id)
+{
+    task_topology_entry_t *entry = &task_topology[id];
+
+    if (entry->handle == NULL) {
+        entry->handle = xTaskGetHandle(entry->name);
+        if (entry->handle == NULL) return 0;
+    }
+
+    return uxTaskGetStackHighWaterMark(entry->handle);
+}
+
+void task_topology_log(void)
+{
+    for (int i = 0; i < TASK_COUNT; i++) {
+        ESP_LOGI(TAG, "%-10s core %2d prio %2u stack %5" PRIu32 " free %5" PRIu32,
+                 task_topology[i].name,
+                 task_topology[i].core_id == tskNO_AFFINITY ? -1 : (int)task_topology[i].core_id,
+                 task_topology[i].priority,
+                 task_topology[i].stack_size,
+                 task_topology_stack_free(i));
+    }
+}
@@ -1,4 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define WATER_ZONE_COUNT    1
+#define WATER_STATS_VERSION 2
+
+typedef enum {
+    WATER_PERIOD_HOUR = 0,
+    WATER_PERIOD_DAY,
+    WATER_PERIOD_WEEK,
+    WATER_PERIOD_MONTH,
+    WATER_PERIOD_COUNT,
+} water_period_t;
+
+// 24 hours, 31 days, 12 weeks and 12 months per zone
+#define WATER_STATS_BUCKETS (24 + 31 + 12 + 12)
+#define WATER_STATS_MAX_HISTORY 31
+
+typedef struct {
+    uint32_t period;
+    uint32_t count;
+    uint64_t open_ms;           // kept in ms so short waterings are not rounded away
+    uint32_t volume_ml;
+} water_bucket_t;
+
+typedef struct {
+    uint32_t version;
+    water_bucket_t buckets[WATER_ZONE_COUNT][WATER_STATS_BUCKETS];
+    water_bucket_t total[WATER_ZONE_COUNT];
+} water_stats_t;
+
+typedef struct {
+    time_t planned;
+    time_t started;
+    int64_t lateness_ms;
+    bool caught_up;
+} watering_record_t;
+
+typedef struct {
+    uint32_t samples;
+    int64_t max_ms;
+    int64_t p50_ms;
+    int64_t p99_ms;
+    uint32_t missed;
+    uint32_t caught_up;
+    watering_record_t last;
+} lateness_stats_t;
+
 void initialize_water_timer(void);
-void stop_timers(void);
+bool stop_timers(void);
+void get_lateness_stats(lateness_stats_t *stats);
+bool water_timer_running(void);
+bool water_timer_busy(void);
+
+void water_stats_current(uint8_t zone, water_period_t period, water_bucket_t *bucket);
+int water_stats_history(uint8_t zone, water_period_t period, water_bucket_t *buckets, int max);
+void water_stats_total(uint8_t zone, water_bucket_t *bucket);
+bool water_stats_snapshot(water_stats_t *stats);
+void water_stats_mark_dirty(void);
+void water_stats_restore(const water_stats_t *stats);
 
-extern uint64_t time_left;
\ No newline at end of file
+extern uint64_t time_left;
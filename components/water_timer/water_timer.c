@@ -1,8 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #include <esp_timer.h>
 #include <driver/gpio.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
 #include <esp_tls.h>
 #include <esp_sntp.h>
@@ -12,48 +16,210 @@
 
 #include <http_server.h>
 #include <data_storage.h>
+#include <task_topology.h>
 
 #define HOSE_PIN GPIO_NUM_26
+#define SCHEDULER_HEARTBEAT_TIMEOUT_US (5 * 1000 * 1000)
+#define SCHEDULER_STOP_TIMEOUT_MS 2000
 
 void calculate_time_left(void);
+void watering_task(void);
 
 static const char *TAG = "Water Timer";
 
 TaskHandle_t time_left_calc_handle;
+TaskHandle_t watering_handle;
 
-bool is_watering = false;
+volatile bool is_watering = false;
+static volatile int64_t scheduler_heartbeat = 0;
+static volatile bool scheduler_advancing = false;
+
+// Held by the scheduler while it decides and starts a watering, and by stop_timers() for the whole pause
+static StaticSemaphore_t scheduler_lock_buffer;
+static SemaphoreHandle_t scheduler_lock;
+static volatile bool scheduler_stopped = false;
+
+static time_t pending_planned;
+static bool pending_caught_up;
+static bool watering_announced = false;     // scheduler only
+
+static const struct {
+    uint16_t offset;
+    uint16_t length;
+} period_layout[WATER_PERIOD_COUNT] = {
+    [WATER_PERIOD_HOUR]  = { 0,  24 },
+    [WATER_PERIOD_DAY]   = { 24, 31 },
+    [WATER_PERIOD_WEEK]  = { 55, 12 },
+    [WATER_PERIOD_MONTH] = { 67, 12 },
+};
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static water_stats_t water_stats = { .version = WATER_STATS_VERSION };
+static bool water_stats_dirty = false;
+
+static portMUX_TYPE lateness_lock = portMUX_INITIALIZER_UNLOCKED;
+static watering_record_t lateness_history[CONFIG_WATER_LATENESS_HISTORY];
+static uint32_t lateness_count = 0;
+static uint32_t missed_count = 0;
+static uint32_t caught_up_count = 0;
 
 void initialize_water_timer(void)
 {   
     gpio_set_direction(HOSE_PIN, GPIO_MODE_OUTPUT);
 
-    xTaskCreate(
-                (TaskFunction_t) &calculate_time_left,
-                "Time Left",
-                4096,
-                NULL,
-                1,
-                &time_left_calc_handle
-            );
+    if (scheduler_lock == NULL) {
+        scheduler_lock = xSemaphoreCreateMutexStatic(&scheduler_lock_buffer);
+    }
+
+    // Tasks run on static stacks, so they are created once and only paused afterwards
+    watering_handle = task_topology_create(TASK_ACTUATOR, (TaskFunction_t) &watering_task, NULL);
+    time_left_calc_handle = task_topology_create(TASK_SCHEDULER, (TaskFunction_t) &calculate_time_left, NULL);
+
+    // Resumes a pause taken by stop_timers(), which must have run on this same task
+    if (scheduler_stopped) {
+        scheduler_stopped = false;
+        xSemaphoreGive(scheduler_lock);
+    }
+}
+
+static void record_watering(time_t planned, struct timeval *started, bool caught_up)
+{
+    watering_record_t record = {
+        .planned = planned,
+        .started = started->tv_sec,
+        .lateness_ms = ((int64_t)started->tv_sec - planned) * 1000 + started->tv_usec / 1000,
+        .caught_up = caught_up,
+    };
+
+    taskENTER_CRITICAL(&lateness_lock);
+    lateness_history[lateness_count % CONFIG_WATER_LATENESS_HISTORY] = record;
+    lateness_count++;
+    if (caught_up) caught_up_count++;
+    taskEXIT_CRITICAL(&lateness_lock);
+
+    ESP_LOGI(TAG, "Watering started %" PRId64 " ms after planned time", record.lateness_ms);
+}
+
+static int32_t local_day_number(const struct tm *timeinfo)
+{
+    // Days since 1970-01-01 for the local calendar date
+    int32_t y = timeinfo->tm_year + 1900 - (timeinfo->tm_mon < 2);
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    int32_t yoe = y - era * 400;
+    int32_t m = timeinfo->tm_mon + 1;
+    int32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + timeinfo->tm_mday - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void period_keys(time_t t, uint32_t keys[WATER_PERIOD_COUNT])
+{
+    struct tm timeinfo;
+    localtime_r(&t, &timeinfo);
+
+    int32_t day = local_day_number(&timeinfo);
+
+    keys[WATER_PERIOD_HOUR] = day * 24 + timeinfo.tm_hour;
+    keys[WATER_PERIOD_DAY] = day;
+    keys[WATER_PERIOD_WEEK] = (day + 3) / 7;      // weeks start on Monday
+    keys[WATER_PERIOD_MONTH] = timeinfo.tm_year * 12 + timeinfo.tm_mon;
+}
+
+static water_bucket_t *stats_bucket(uint8_t zone, water_period_t period, uint32_t key)
+{
+    return &water_stats.buckets[zone][period_layout[period].offset + key % period_layout[period].length];
+}
+
+static void record_usage(uint8_t zone, time_t started, uint32_t open_ms)
+{
+    uint32_t keys[WATER_PERIOD_COUNT];
+    uint32_t volume_ml = (uint64_t)open_ms * CONFIG_WATER_FLOW_ML_PER_MIN / 60000;
+
+    period_keys(started, keys);
+
+    taskENTER_CRITICAL(&stats_lock);
+    for (int p = 0; p < WATER_PERIOD_COUNT; p++) {
+        water_bucket_t *bucket = stats_bucket(zone, p, keys[p]);
+        if (bucket->period != keys[p]) {
+            memset(bucket, 0, sizeof(*bucket));
+            bucket->period = keys[p];
+        }
+        bucket->count++;
+        bucket->open_ms += open_ms;
+        bucket->volume_ml += volume_ml;
+    }
+    water_stats.total[zone].count++;
+    water_stats.total[zone].open_ms += open_ms;
+    water_stats.total[zone].volume_ml += volume_ml;
+    water_stats_dirty = true;
+    taskEXIT_CRITICAL(&stats_lock);
 }
 
 void watering_task(void)
 {   
+    while(1)
+    {
+        struct timeval started;
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        gettimeofday(&started, NULL);
+        int64_t opened_at = esp_timer_get_time();
+        gpio_set_level(HOSE_PIN, 1);
+
+        record_watering(pending_planned, &started, pending_caught_up);
+
+        vTaskDelay(pdMS_TO_TICKS(watering_duration / 1000));
+
+        gpio_set_level(HOSE_PIN, 0);
+
+        record_usage(0, started.tv_sec, (uint32_t)((esp_timer_get_time() - opened_at) / 1000));
+
+        is_watering = false;
+    }
+}
+
+static void start_watering(time_t planned, bool caught_up)
+{
     is_watering = true;
 
-    gpio_set_level(HOSE_PIN, 1);
+    pending_planned = planned;
+    pending_caught_up = caught_up;
 
-    vTaskDelay(pdMS_TO_TICKS(watering_duration / 1000));
+    xTaskNotifyGive(watering_handle);
 
-    gpio_set_level(HOSE_PIN, 0);
+    watering_announced = true;
+    // Published from the scheduler so the actuator never blocks on mDNS while the valve is open
+    publish_status_change();
+}
 
-    is_watering = false;
+static bool should_catch_up(double seconds_late)
+{
+    switch (catch_up_policy) {
+        case CATCH_UP_RUN_ONCE:
+            return true;
+        case CATCH_UP_WITHIN:
+            return seconds_late <= catch_up_max_late;
+        case CATCH_UP_SKIP:
+        default:
+            return false;
+    }
 }
 
 void calculate_time_left(void)
 {   
     while(1)
     {   
+        bool advance = false;
+
+        xSemaphoreTake(scheduler_lock, portMAX_DELAY);
+        scheduler_heartbeat = esp_timer_get_time();
+
+        if (watering_announced && is_watering == false) {
+            watering_announced = false;
+            publish_status_change();
+        }
+
         if(is_watering == false)
         {
             time_t now;
@@ -67,21 +233,187 @@ void calculate_time_left(void)
             ESP_LOGI(TAG, "CURRENT TIME -> %s", strftime_buf);
 
             double seconds = difftime(now, incr_time);
-            if (seconds > 0) {
-                
-                update_incr_time();
+            if (incr_time == 0) {
+
+                advance = true;
+
+            } else if (seconds >= 0 && seconds <= CONFIG_WATER_ON_TIME_GRACE_S) {
 
-            } else if (seconds == 0) {
-                
-                watering_task();
+                start_watering(incr_time, false);
+                advance = true;
+
+            } else if (seconds > 0) {
+
+                if (should_catch_up(seconds)) {
+                    ESP_LOGW(TAG, "Watering missed by %.0f s, catching up", seconds);
+                    start_watering(incr_time, true);
+                } else {
+                    ESP_LOGW(TAG, "Watering missed by %.0f s, skipping", seconds);
+                    taskENTER_CRITICAL(&lateness_lock);
+                    missed_count++;
+                    taskEXIT_CRITICAL(&lateness_lock);
+                    publish_status_change();
+                }
+                advance = true;
             
             } else ESP_LOGI(TAG, "Non e' ancora passato");
         }
+        xSemaphoreGive(scheduler_lock);
+
+        // Outside the lock: the timeapi.io requests can block for a long time
+        if (advance) {
+            // Liveness is about the scheduler itself, not how long timeapi.io takes to answer
+            scheduler_advancing = true;
+            update_incr_time();
+            scheduler_advancing = false;
+            scheduler_heartbeat = esp_timer_get_time();
+        }
+
         vTaskDelay(pdMS_TO_TICKS(500));
     }
 }
 
-void stop_timers(void)
+static int compare_lateness(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void get_lateness_stats(lateness_stats_t *stats)
+{
+    int64_t sorted[CONFIG_WATER_LATENESS_HISTORY];
+    uint32_t n;
+
+    memset(stats, 0, sizeof(*stats));
+
+    taskENTER_CRITICAL(&lateness_lock);
+    n = lateness_count < CONFIG_WATER_LATENESS_HISTORY ? lateness_count : CONFIG_WATER_LATENESS_HISTORY;
+    for (uint32_t i = 0; i < n; i++) {
+        sorted[i] = lateness_history[i].lateness_ms;
+    }
+    if (lateness_count > 0) {
+        stats->last = lateness_history[(lateness_count - 1) % CONFIG_WATER_LATENESS_HISTORY];
+    }
+    stats->missed = missed_count;
+    stats->caught_up = caught_up_count;
+    taskEXIT_CRITICAL(&lateness_lock);
+
+    stats->samples = n;
+    if (n == 0) return;
+
+    qsort(sorted, n, sizeof(sorted[0]), compare_lateness);
+    stats->max_ms = sorted[n - 1];
+    stats->p50_ms = sorted[(n - 1) * 50 / 100];
+    stats->p99_ms = sorted[(n - 1) * 99 / 100];
+}
+
+void water_stats_current(uint8_t zone, water_period_t period, water_bucket_t *bucket)
+{
+    uint32_t keys[WATER_PERIOD_COUNT];
+    time_t now;
+
+    time(&now);
+    period_keys(now, keys);
+
+    taskENTER_CRITICAL(&stats_lock);
+    *bucket = *stats_bucket(zone, period, keys[period]);
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (bucket->period != keys[period]) {
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->period = keys[period];
+    }
+}
+
+int water_stats_history(uint8_t zone, water_period_t period, water_bucket_t *buckets, int max)
+{
+    uint32_t keys[WATER_PERIOD_COUNT];
+    time_t now;
+    int n = period_layout[period].length < max ? period_layout[period].length : max;
+
+    time(&now);
+    period_keys(now, keys);
+
+    // Newest first, ring slots left over from an older period read as empty
+    taskENTER_CRITICAL(&stats_lock);
+    for (int i = 0; i < n; i++) {
+        buckets[i] = *stats_bucket(zone, period, keys[period] - i);
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    for (int i = 0; i < n; i++) {
+        if (buckets[i].period != keys[period] - i) {
+            memset(&buckets[i], 0, sizeof(buckets[i]));
+            buckets[i].period = keys[period] - i;
+        }
+    }
+
+    return n;
+}
+
+void water_stats_total(uint8_t zone, water_bucket_t *bucket)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    *bucket = water_stats.total[zone];
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+bool water_stats_snapshot(water_stats_t *stats)
+{
+    bool dirty;
+
+    taskENTER_CRITICAL(&stats_lock);
+    dirty = water_stats_dirty;
+    if (dirty) {
+        *stats = water_stats;
+        water_stats_dirty = false;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    return dirty;
+}
+
+void water_stats_mark_dirty(void)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    water_stats_dirty = true;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+void water_stats_restore(const water_stats_t *stats)
+{
+    if (stats->version != WATER_STATS_VERSION) {
+        ESP_LOGW(TAG, "Discarding water stats version %" PRIu32, stats->version);
+        return;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    water_stats = *stats;
+    water_stats_dirty = false;
+    taskEXIT_CRITICAL(&stats_lock);
+}
+
+bool water_timer_running(void)
+{
+    return time_left_calc_handle != NULL && scheduler_stopped == false &&
+           (scheduler_advancing || esp_timer_get_time() - scheduler_heartbeat < SCHEDULER_HEARTBEAT_TIMEOUT_US);
+}
+
+bool water_timer_busy(void)
 {
-    vTaskDelete(time_left_calc_handle);
+    return is_watering;
+}
+
+bool stop_timers(void)
+{
+    if (scheduler_lock == NULL || scheduler_stopped) return true;
+
+    // Waits for the scheduler to finish starting a watering, then keeps it out until initialize_water_timer()
+    if (xSemaphoreTake(scheduler_lock, pdMS_TO_TICKS(SCHEDULER_STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Scheduler did not stop within %d ms", SCHEDULER_STOP_TIMEOUT_MS);
+        return false;
+    }
+    scheduler_stopped = true;
+    return true;
 }
\ No newline at end of file
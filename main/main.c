@@ -2,11 +2,19 @@
 #include <http_server.h>
 #include <water_timer.h>
 #include <data_storage.h>
+#include <task_topology.h>
+#include <ota_update.h>
 
 void app_main(void)
 {   
+    start_ota_health_check();
+
     setup_wifi();
     setup_server();
 
     initialize_water_timer();
+
+    start_storage_writer();
+
+    task_topology_log();
 }
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <data_storage.h>
+
+// libFuzzer entry point. Built with clang it links against -fsanitize=fuzzer,
+// with any other compiler fuzz_replay.c drives it over the seed corpus.
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    time_data_t parsed;
+
+    // The body is not NUL terminated, as it is not in post_update_data_handler()
+    if (parse_time_data((const char *)data, size, &parsed) != ESP_OK) {
+        return 0;
+    }
+
+    if (parsed.catch_up_policy > CATCH_UP_WITHIN) abort();
+    if (parsed.watering_duration > UINT64_MAX / 1000) abort();
+    if (parsed.catch_up_max_late % 60 != 0) abort();
+
+    return 0;
+}
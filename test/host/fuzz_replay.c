@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include <data_storage.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Seeds named valid_* must be accepted, every other seed must be rejected
+static int check_verdict(const char *path, const uint8_t *data, size_t size)
+{
+    char name[4096];
+    time_data_t parsed;
+
+    snprintf(name, sizeof(name), "%s", path);
+    bool expect_valid = strncmp(basename(name), "valid_", 6) == 0;
+    bool valid = parse_time_data((const char *)data, size, &parsed) == ESP_OK;
+
+    if (valid != expect_valid) {
+        fprintf(stderr, "%s: %s, expected %s\n", path,
+                valid ? "accepted" : "rejected", expect_valid ? "accepted" : "rejected");
+        return -1;
+    }
+    return 0;
+}
+
+static int replay_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    // Exact size allocation, so a read past the input trips the sanitizers
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data == NULL || fread(data, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(data);
+        return -1;
+    }
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(data, size);
+    int ret = check_verdict(path, data, size);
+    free(data);
+    return ret;
+}
+
+static int replay_path(const char *path, int *count)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        (*count)++;
+        return replay_file(path);
+    }
+
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    int ret = 0;
+
+    while (dir && (entry = readdir(dir)) != NULL) {
+        char child[4096];
+
+        if (entry->d_name[0] == '.') continue;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (replay_path(child, count) != 0) ret = -1;
+    }
+    if (dir) closedir(dir);
+
+    return ret;
+}
+
+// Runs every file given, or every file under the directories given, through
+// the fuzz entry point once and checks it is accepted or rejected as its name
+// says. Used where libFuzzer is not available.
+int main(int argc, char **argv)
+{
+    int count = 0, ret = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (replay_path(argv[i], &count) != 0) ret = 1;
+    }
+
+    printf("Replayed %d inputs\n", count);
+    return ret;
+}
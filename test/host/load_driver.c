@@ -0,0 +1,666 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "host_harness.h"
+#include <http_server.h>
+#include <data_storage.h>
+#include <cJSON.h>
+
+#if HOST_HEAP_TRACKING
+#include <malloc.h>
+#endif
+
+#define MAX_RECV_RETRIES    3       // as in http_server.c
+#define MAX_UPDATE_BODY     512
+#define MAX_VIOLATION_LOGS  5
+
+typedef enum {
+    SCENARIO_VALID = 0,
+    SCENARIO_FRAGMENTED,
+    SCENARIO_MALFORMED,
+    SCENARIO_READ,
+    SCENARIO_NVS_FAULT,
+    SCENARIO_COUNT,
+} scenario_t;
+
+static const char *scenario_names[SCENARIO_COUNT] = {
+    [SCENARIO_VALID]      = "valid",
+    [SCENARIO_FRAGMENTED] = "fragmented",
+    [SCENARIO_MALFORMED]  = "malformed",
+    [SCENARIO_READ]       = "read",
+    [SCENARIO_NVS_FAULT]  = "nvs_fault",
+};
+
+typedef enum {
+    OUTCOME_2XX = 0,
+    OUTCOME_4XX,
+    OUTCOME_429,
+    OUTCOME_5XX,
+    OUTCOME_CLOSED,
+    OUTCOME_COUNT,
+} outcome_t;
+
+/* Heap accounting. The executable links with --wrap for the allocator, so
+ * every allocation made by cJSON and the components is counted. */
+
+static atomic_llong heap_in_use;
+static atomic_llong heap_peak;
+
+#if HOST_HEAP_TRACKING
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void heap_add(long long n)
+{
+    long long now = atomic_fetch_add(&heap_in_use, n) + n;
+    long long peak = atomic_load(&heap_peak);
+
+    while (now > peak && !atomic_compare_exchange_weak(&heap_peak, &peak, now)) {
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *p = __real_malloc(size);
+    if (p) heap_add(malloc_usable_size(p));
+    return p;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    void *p = __real_calloc(n, size);
+    if (p) heap_add(malloc_usable_size(p));
+    return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    long long old = ptr ? (long long)malloc_usable_size(ptr) : 0;
+    void *p = __real_realloc(ptr, size);
+
+    if (p) {
+        heap_add((long long)malloc_usable_size(p) - old);
+    } else if (size == 0) {
+        heap_add(-old);
+    }
+    return p;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr) heap_add(-(long long)malloc_usable_size(ptr));
+    __real_free(ptr);
+}
+#endif
+
+/* Executor. Handlers and session callbacks only ever run here, one at a
+ * time, the way the single httpd task runs them on the device. */
+
+typedef enum {
+    JOB_CONNECT,
+    JOB_REQUEST,
+    JOB_DISCONNECT,
+    JOB_CALL,
+    JOB_STOP,
+} job_type_t;
+
+typedef struct job {
+    job_type_t type;
+    uint32_t peer_addr;
+    int sockfd;
+    const host_request_t *request;
+    host_response_t *response;
+    void (*fn)(void *arg);
+    void *arg;
+    int result;
+    int64_t service_us;
+    bool scheduler_paused;
+    bool done;
+    struct job *next;
+} job_t;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static job_t *queue_head;
+static job_t *queue_tail;
+
+static void *executor_main(void *arg)
+{
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == NULL) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        job_t *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL) queue_tail = NULL;
+        pthread_mutex_unlock(&queue_lock);
+
+        int64_t started = esp_timer_get_time();
+        switch (job->type) {
+            case JOB_CONNECT:
+                job->result = host_httpd_connect(job->peer_addr);
+                break;
+            case JOB_REQUEST:
+                job->result = host_httpd_request(job->sockfd, job->request, job->response);
+                job->scheduler_paused = host_scheduler_paused();
+                break;
+            case JOB_DISCONNECT:
+                host_httpd_disconnect(job->sockfd);
+                break;
+            case JOB_CALL:
+                job->fn(job->arg);
+                break;
+            case JOB_STOP:
+                break;
+        }
+        job->service_us = esp_timer_get_time() - started;
+
+        // The job lives on the submitter's stack and is gone once it is done
+        bool stop = job->type == JOB_STOP;
+
+        pthread_mutex_lock(&queue_lock);
+        job->done = true;
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&queue_lock);
+
+        if (stop) return NULL;
+    }
+}
+
+static void submit(job_t *job)
+{
+    job->done = false;
+    job->next = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    pthread_cond_signal(&queue_cond);
+
+    while (!job->done) {
+        pthread_cond_wait(&done_cond, &queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void run_on_executor(void (*fn)(void *arg), void *arg)
+{
+    job_t job = { .type = JOB_CALL, .fn = fn, .arg = arg };
+    submit(&job);
+}
+
+/* Clients */
+
+typedef struct {
+    int id;
+    scenario_t scenario;
+    unsigned requests;
+    unsigned keepalive;
+    uint32_t rng;
+    uint32_t *latency_us;
+    uint32_t *service_us;
+    unsigned completed;
+    unsigned outcomes[OUTCOME_COUNT];
+    unsigned refused;
+    unsigned violations;
+} client_t;
+
+static atomic_uint violation_logs;
+
+static uint32_t next_random(client_t *client)
+{
+    client->rng ^= client->rng << 13;
+    client->rng ^= client->rng >> 17;
+    client->rng ^= client->rng << 5;
+    return client->rng;
+}
+
+static size_t valid_body(client_t *client, char *buf, size_t len)
+{
+    static const char *policies[] = { "skip", "run_once", "within" };
+
+    return snprintf(buf, len,
+                    "{\"Watering_Interval\":{\"Days\":%u,\"Hours\":%u},\"Watering_Duration\":\"%u\","
+                    "\"Catch_Up\":{\"Policy\":\"%s\",\"Max_Late_Minutes\":%u}}",
+                    next_random(client) % 30, next_random(client) % 24, next_random(client) % 3600 + 1,
+                    policies[next_random(client) % 3], next_random(client) % 240);
+}
+
+static size_t malformed_body(client_t *client, char *buf, size_t len)
+{
+    static const char *templates[] = {
+        "",
+        "{",
+        "null",
+        "[]",
+        "{}",
+        "{\"Watering_Interval\":{\"Days\":-1,\"Hours\":2},\"Watering_Duration\":\"5\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":70000},\"Watering_Duration\":\"5\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":\"2\"},\"Watering_Duration\":\"5\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":5}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":\"-5\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":\"5x\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":\"\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":\"99999999999999999999999\"}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":\"5\",\"Catch_Up\":{\"Policy\":\"never\"}}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Duration\":\"5\",\"Catch_Up\":{\"Policy\":3}}",
+        "{\"Watering_Interval\":{\"Days\":1,\"Hours\":2},\"Watering_Dur",
+    };
+    uint32_t pick = next_random(client) % (sizeof(templates) / sizeof(templates[0]) + 3);
+    size_t n;
+
+    if (pick < sizeof(templates) / sizeof(templates[0])) {
+        return snprintf(buf, len, "%s", templates[pick]);
+    }
+
+    switch (pick - sizeof(templates) / sizeof(templates[0])) {
+        case 0:
+            // Random bytes that can never start a JSON object
+            n = next_random(client) % MAX_UPDATE_BODY + 1;
+            for (size_t i = 0; i < n; i++) buf[i] = (char)(next_random(client) & 0xff);
+            buf[0] = 'x';
+            return n;
+        case 1:
+            // Deep nesting under the body limit
+            n = 200;
+            memset(buf, '[', n);
+            memset(buf + n, ']', n);
+            return 2 * n;
+        default:
+            // Valid document padded past the body limit
+            n = valid_body(client, buf, len);
+            memset(buf + n - 1, ' ', MAX_UPDATE_BODY);
+            buf[n - 1 + MAX_UPDATE_BODY] = '}';
+            return n + MAX_UPDATE_BODY;
+    }
+}
+
+static void violation(client_t *client, const host_request_t *request, const host_response_t *response,
+                      const char *expected)
+{
+    client->violations++;
+    if (atomic_fetch_add(&violation_logs, 1) < MAX_VIOLATION_LOGS) {
+        fprintf(stderr, "[%s] %s %s: got %d%s, expected %s\n", scenario_names[client->scenario],
+                request->method == HTTP_POST ? "POST" : "GET", request->uri, response->status,
+                response->closed ? " (closed)" : "", expected);
+    }
+}
+
+static void check_response(client_t *client, const host_request_t *request, const host_response_t *response,
+                           bool scheduler_paused)
+{
+    // The stub returns a timeout between two fragments, so only that many can fire
+    size_t fragments = request->fragment ? (request->body_len + request->fragment - 1) / request->fragment : 1;
+    size_t timeouts = request->timeouts < fragments - 1 ? request->timeouts : fragments - 1;
+    bool dropped = request->truncate_at || timeouts > MAX_RECV_RETRIES;
+
+    switch (client->scenario) {
+        case SCENARIO_VALID:
+            if (response->status != 200 || response->body_len != request->body_len ||
+                memcmp(response->body, request->body, request->body_len) != 0) {
+                violation(client, request, response, "200 echoing the body");
+            }
+            break;
+        case SCENARIO_FRAGMENTED:
+            if (dropped && (!response->closed || response->status != 0)) {
+                violation(client, request, response, "closed without a response");
+            } else if (!dropped && response->status != 200) {
+                violation(client, request, response, "200");
+            }
+            break;
+        case SCENARIO_MALFORMED:
+            if (response->status != 400 && response->status != 413) {
+                violation(client, request, response, "400 or 413");
+            }
+            break;
+        case SCENARIO_READ:
+            if (response->status != 200) {
+                violation(client, request, response, "200");
+            }
+            break;
+        case SCENARIO_NVS_FAULT:
+            if (response->status != 200 && response->status != 500) {
+                violation(client, request, response, "200 or 500");
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (scheduler_paused) {
+        violation(client, request, response, "scheduler resumed after the handler");
+    }
+}
+
+static void classify(client_t *client, const host_response_t *response)
+{
+    if (response->closed && response->status == 0) {
+        client->outcomes[OUTCOME_CLOSED]++;
+    } else if (response->status == 429) {
+        client->outcomes[OUTCOME_429]++;
+    } else if (response->status >= 500) {
+        client->outcomes[OUTCOME_5XX]++;
+    } else if (response->status >= 400) {
+        client->outcomes[OUTCOME_4XX]++;
+    } else {
+        client->outcomes[OUTCOME_2XX]++;
+    }
+}
+
+static void *client_main(void *arg)
+{
+    static const char *read_uris[] = {
+        "/", "/time_left", "/stats", "/stats?period=hour", "/stats?period=day", "/lateness", "/tasks", "/http_stats",
+    };
+    client_t *client = arg;
+    char body[2 * MAX_UPDATE_BODY + 64];
+    host_response_t response;
+    int sockfd = -1;
+    unsigned on_connection = 0;
+
+    while (client->completed < client->requests) {
+        host_request_t request = { .method = HTTP_POST, .uri = "/update_data", .body = body };
+
+        if (sockfd < 0) {
+            job_t job = { .type = JOB_CONNECT, .peer_addr = 0x0a000000u + client->id };
+            submit(&job);
+            if (job.result < 0) {
+                client->refused++;
+                sched_yield();
+                continue;
+            }
+            sockfd = job.result;
+            on_connection = 0;
+        }
+
+        switch (client->scenario) {
+            case SCENARIO_VALID:
+            case SCENARIO_NVS_FAULT:
+                request.body_len = valid_body(client, body, sizeof(body));
+                break;
+            case SCENARIO_FRAGMENTED:
+                request.body_len = valid_body(client, body, sizeof(body));
+                request.fragment = next_random(client) % 16 + 1;
+                request.timeouts = next_random(client) % (MAX_RECV_RETRIES + 2);
+                if (next_random(client) % 8 == 0) {
+                    request.truncate_at = next_random(client) % request.body_len + 1;
+                    if (request.truncate_at == request.body_len) request.truncate_at = 0;
+                }
+                break;
+            case SCENARIO_MALFORMED:
+                request.body_len = malformed_body(client, body, sizeof(body));
+                break;
+            case SCENARIO_READ:
+            default:
+                request.method = HTTP_GET;
+                request.uri = read_uris[next_random(client) % (sizeof(read_uris) / sizeof(read_uris[0]))];
+                request.body = NULL;
+                break;
+        }
+
+        job_t job = { .type = JOB_REQUEST, .sockfd = sockfd, .request = &request, .response = &response };
+        int64_t started = esp_timer_get_time();
+        submit(&job);
+
+        client->latency_us[client->completed] = (uint32_t)(esp_timer_get_time() - started);
+        client->service_us[client->completed] = (uint32_t)job.service_us;
+        client->completed++;
+
+        classify(client, &response);
+        check_response(client, &request, &response, job.scheduler_paused);
+
+        if (response.closed) {
+            sockfd = -1;
+        } else if (++on_connection >= client->keepalive) {
+            job_t close_job = { .type = JOB_DISCONNECT, .sockfd = sockfd };
+            submit(&close_job);
+            sockfd = -1;
+        }
+    }
+
+    if (sockfd >= 0) {
+        job_t close_job = { .type = JOB_DISCONNECT, .sockfd = sockfd };
+        submit(&close_job);
+    }
+
+    return NULL;
+}
+
+/* Scenarios */
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void set_nvs_fault(void *arg)
+{
+    host_nvs_fail_every(*(unsigned *)arg, ESP_ERR_NVS_NO_FREE_PAGES);
+}
+
+static unsigned run_scenario(scenario_t scenario, int clients, unsigned requests, unsigned keepalive, uint32_t seed)
+{
+    client_t *client = calloc(clients, sizeof(client_t));
+    pthread_t *threads = calloc(clients, sizeof(pthread_t));
+    uint32_t *latency = calloc((size_t)clients * requests, sizeof(uint32_t));
+    uint32_t *service = calloc((size_t)clients * requests, sizeof(uint32_t));
+    unsigned outcomes[OUTCOME_COUNT] = { 0 };
+    unsigned refused = 0, violations = 0, total = 0;
+
+    if (!client || !threads || !latency || !service) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < clients; i++) {
+        client[i].id = i + 1;
+        client[i].scenario = scenario;
+        client[i].requests = requests;
+        client[i].keepalive = keepalive;
+        client[i].rng = seed * 2654435761u + i * 40503u + scenario + 1;
+        client[i].latency_us = latency + (size_t)i * requests;
+        client[i].service_us = service + (size_t)i * requests;
+    }
+
+    unsigned fault_every = scenario == SCENARIO_NVS_FAULT ? 16 : 0;
+    run_on_executor(set_nvs_fault, &fault_every);
+
+    long long heap_baseline = atomic_load(&heap_in_use);
+    atomic_store(&heap_peak, heap_baseline);
+
+    int64_t started = esp_timer_get_time();
+    for (int i = 0; i < clients; i++) {
+        pthread_create(&threads[i], NULL, client_main, &client[i]);
+    }
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    int64_t elapsed = esp_timer_get_time() - started;
+    long long heap_high_water = atomic_load(&heap_peak) - heap_baseline;
+
+    fault_every = 0;
+    run_on_executor(set_nvs_fault, &fault_every);
+
+    for (int i = 0; i < clients; i++) {
+        for (int o = 0; o < OUTCOME_COUNT; o++) outcomes[o] += client[i].outcomes[o];
+        refused += client[i].refused;
+        violations += client[i].violations;
+        total += client[i].completed;
+    }
+
+    qsort(latency, total, sizeof(uint32_t), compare_u32);
+    qsort(service, total, sizeof(uint32_t), compare_u32);
+
+    printf("%-11s %7d %8u %9.0f %8u %8u %8u %8u %8u",
+           scenario_names[scenario], clients, total, total * 1e6 / (elapsed > 0 ? elapsed : 1),
+           latency[(total - 1) * 50 / 100], latency[(total - 1) * 99 / 100],
+           service[(total - 1) * 50 / 100], service[(total - 1) * 99 / 100], service[total - 1]);
+#if HOST_HEAP_TRACKING
+    printf(" %8lld", heap_high_water);
+#else
+    (void)heap_high_water;
+    printf(" %8s", "n/a");
+#endif
+    printf(" %6u %6u %6u %6u %6u %7u\n", outcomes[OUTCOME_2XX], outcomes[OUTCOME_4XX], outcomes[OUTCOME_429],
+           outcomes[OUTCOME_5XX], outcomes[OUTCOME_CLOSED], refused);
+
+    free(client);
+    free(threads);
+    free(latency);
+    free(service);
+
+    return violations;
+}
+
+/* Checks after the load */
+
+typedef struct {
+    int open_sessions;
+    int peak_sessions;
+    int status;
+    uint16_t days;
+    uint16_t hours;
+    uint64_t duration;
+} final_state_t;
+
+static void start_server(void *arg)
+{
+    get_data_values();
+    setup_server();
+}
+
+static void read_final_state(void *arg)
+{
+    static const char known_body[] =
+        "{\"Watering_Interval\":{\"Days\":3,\"Hours\":4},\"Watering_Duration\":\"42\"}";
+    final_state_t *state = arg;
+    host_request_t stats = { .method = HTTP_GET, .uri = "/http_stats" };
+    host_request_t update = { .method = HTTP_POST, .uri = "/update_data", .body = known_body,
+                              .body_len = sizeof(known_body) - 1 };
+    host_response_t response;
+    nvs_handle_t handle;
+
+    state->open_sessions = -1;
+    state->peak_sessions = host_httpd_peak_sessions();
+
+    int sockfd = host_httpd_connect(0x0a0000ffu);
+    if (sockfd < 0) return;
+
+    host_httpd_request(sockfd, &stats, &response);
+    cJSON *root = cJSON_ParseWithLength(response.body, response.body_len);
+    cJSON *open = cJSON_GetObjectItem(root, "open_sessions");
+    if (cJSON_IsNumber(open)) state->open_sessions = open->valueint;
+    cJSON_Delete(root);
+
+    host_httpd_request(sockfd, &update, &response);
+    state->status = response.status;
+    host_httpd_disconnect(sockfd);
+
+    nvs_open("dataStrg", NVS_READONLY, &handle);
+    nvs_get_u16(handle, "daysIntrv", &state->days);
+    nvs_get_u16(handle, "hoursIntrv", &state->hours);
+    nvs_get_u64(handle, "waterDurat", &state->duration);
+    nvs_close(handle);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-c clients] [-n requests per client] [-k requests per connection] [-s seed]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int clients = 8;
+    unsigned requests = 2000;
+    unsigned keepalive = 8;
+    uint32_t seed = 1;
+    unsigned failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:k:s:")) != -1) {
+        switch (opt) {
+            case 'c': clients = atoi(optarg); break;
+            case 'n': requests = (unsigned)strtoul(optarg, NULL, 10); break;
+            case 'k': keepalive = (unsigned)strtoul(optarg, NULL, 10); break;
+            case 's': seed = (uint32_t)strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (clients < 1 || requests < 1 || keepalive < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    pthread_t executor;
+    pthread_create(&executor, NULL, executor_main, NULL);
+    run_on_executor(start_server, NULL);
+
+    long long heap_start = atomic_load(&heap_in_use);
+
+    printf("%d clients, %u requests each, %u per connection, %d sessions in flight at most\n\n",
+           clients, requests, keepalive, CONFIG_HTTP_MAX_IN_FLIGHT);
+    printf("%-11s %7s %8s %9s %8s %8s %8s %8s %8s %8s %6s %6s %6s %6s %6s %7s\n",
+           "scenario", "clients", "requests", "req/s", "lat_p50", "lat_p99", "svc_p50", "svc_p99", "svc_max",
+           "heap_hw", "2xx", "4xx", "429", "5xx", "closed", "refused");
+
+    for (int s = 0; s < SCENARIO_COUNT; s++) {
+        failures += run_scenario(s, clients, requests, keepalive, seed);
+    }
+    printf("\nLatencies in microseconds, lat includes queueing behind other clients, "
+           "svc is the handler alone. heap_hw is bytes above the scenario start.\n");
+
+    final_state_t state = { 0 };
+    run_on_executor(read_final_state, &state);
+
+    if (state.peak_sessions > CONFIG_HTTP_MAX_IN_FLIGHT) {
+        fprintf(stderr, "%d sessions were accepted at once, the cap is %d\n",
+                state.peak_sessions, CONFIG_HTTP_MAX_IN_FLIGHT);
+        failures++;
+    }
+    if (state.open_sessions != 1) {
+        fprintf(stderr, "open_sessions is %d with one client connected\n", state.open_sessions);
+        failures++;
+    }
+    if (state.status != 200 || state.days != 3 || state.hours != 4 || state.duration != 42 * 1000) {
+        fprintf(stderr, "Update not persisted: status %d, days %u, hours %u, duration %llu\n",
+                state.status, state.days, state.hours, (unsigned long long)state.duration);
+        failures++;
+    }
+
+#if HOST_HEAP_TRACKING
+    long long leaked = atomic_load(&heap_in_use) - heap_start;
+    if (leaked != 0) {
+        fprintf(stderr, "%lld bytes still allocated after the load\n", leaked);
+        failures++;
+    }
+#else
+    (void)heap_start;
+#endif
+
+    job_t stop = { .type = JOB_STOP };
+    submit(&stop);
+    pthread_join(executor, NULL);
+
+    if (failures) {
+        fprintf(stderr, "%u check(s) failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "host_harness.h"
+
+#include <water_timer.h>
+#include <task_topology.h>
+#include <ota_update.h>
+
+// Stand-ins for the components http_server.c and data_storage.c call into but
+// that are not under test on the host
+
+static bool scheduler_paused = false;
+
+task_topology_entry_t task_topology[TASK_COUNT] = {
+    [TASK_SCHEDULER] = { .name = "scheduler", .stack_size = 4096, .priority = 5, .core_id = 1 },
+    [TASK_ACTUATOR]  = { .name = "actuator",  .stack_size = 2048, .priority = 6, .core_id = 1 },
+    [TASK_HTTPD]     = { .name = "httpd",     .stack_size = 8192, .priority = 4, .core_id = 0 },
+    [TASK_STORAGE]   = { .name = "storage",   .stack_size = 3072, .priority = 2, .core_id = 0 },
+};
+
+TaskHandle_t task_topology_create(task_id_t id, TaskFunction_t task, void *arg)
+{
+    // Nothing is started, the driver plays every task itself
+    return &task_topology[id];
+}
+
+uint32_t task_topology_stack_free(task_id_t id)
+{
+    return task_topology[id].stack_size;
+}
+
+void task_topology_log(void)
+{
+}
+
+bool host_scheduler_paused(void)
+{
+    return scheduler_paused;
+}
+
+void initialize_water_timer(void)
+{
+    scheduler_paused = false;
+}
+
+bool stop_timers(void)
+{
+    scheduler_paused = true;
+    return true;
+}
+
+void get_lateness_stats(lateness_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+bool water_timer_running(void)
+{
+    return !scheduler_paused;
+}
+
+bool water_timer_busy(void)
+{
+    return false;
+}
+
+void water_stats_current(uint8_t zone, water_period_t period, water_bucket_t *bucket)
+{
+    memset(bucket, 0, sizeof(*bucket));
+}
+
+int water_stats_history(uint8_t zone, water_period_t period, water_bucket_t *buckets, int max)
+{
+    static const int lengths[WATER_PERIOD_COUNT] = { 24, 31, 12, 12 };
+    int n = lengths[period] < max ? lengths[period] : max;
+
+    memset(buckets, 0, n * sizeof(*buckets));
+    return n;
+}
+
+void water_stats_total(uint8_t zone, water_bucket_t *bucket)
+{
+    memset(bucket, 0, sizeof(*bucket));
+}
+
+bool water_stats_snapshot(water_stats_t *stats)
+{
+    return false;
+}
+
+void water_stats_mark_dirty(void)
+{
+}
+
+void water_stats_restore(const water_stats_t *stats)
+{
+}
+
+esp_err_t post_ota_handler(httpd_req_t *req)
+{
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No OTA on the host");
+    return ESP_OK;
+}
+
+esp_err_t get_ota_handler(httpd_req_t *req)
+{
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No OTA on the host");
+    return ESP_OK;
+}
+
+void start_ota_health_check(void)
+{
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Driver side of the host stubs. Everything here, like the handlers it calls,
+// must run on the one thread that plays the httpd task.
+
+#include "host_idf.h"
+
+#define HOST_RESPONSE_MAX 2048
+
+typedef struct {
+    httpd_method_t method;
+    const char *uri;                // path, optionally followed by ?query
+    const char *const *headers;     // NULL-terminated name, value pairs, or NULL
+    const char *body;
+    size_t body_len;
+    size_t fragment;                // most bytes per httpd_req_recv(), 0 for no limit
+    unsigned timeouts;              // HTTPD_SOCK_ERR_TIMEOUT results spread over the body
+    size_t truncate_at;             // peer goes away after this many bytes, 0 to send all
+} host_request_t;
+
+typedef struct {
+    int status;                     // 0 when nothing was sent
+    char body[HOST_RESPONSE_MAX + 1];
+    size_t body_len;
+    char retry_after[16];
+    esp_err_t handler_ret;
+    bool closed;                    // httpd closed the session after the handler failed
+} host_response_t;
+
+// Returns the socket, or -1 when the socket limit or open_fn refused it
+int host_httpd_connect(uint32_t peer_addr);
+void host_httpd_disconnect(int sockfd);
+// Most sessions open_fn had accepted at the same time
+int host_httpd_peak_sessions(void);
+esp_err_t host_httpd_request(int sockfd, const host_request_t *request, host_response_t *response);
+
+// Every nth NVS write or commit from now on fails with err, 0 disables
+void host_nvs_fail_every(unsigned nth, esp_err_t err);
+
+// State of the water_timer stand-in
+bool host_scheduler_paused(void);
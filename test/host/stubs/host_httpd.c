@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "host_harness.h"
+
+#define HOST_MAX_SOCKETS    64
+#define HOST_FIRST_SOCKFD   1000
+#define HOST_MAX_URIS       32
+
+typedef struct {
+    bool used;
+    bool accepted;
+    uint32_t peer_addr;
+} host_socket_t;
+
+typedef struct {
+    const host_request_t *in;
+    host_response_t *out;
+    int sockfd;
+    size_t offset;
+    unsigned fragments;
+    unsigned timeouts_left;
+    bool status_set;
+} host_req_ctx_t;
+
+static httpd_config_t server_config;
+static bool server_started = false;
+static httpd_uri_t uris[HOST_MAX_URIS];
+static int uri_count = 0;
+static host_socket_t sockets[HOST_MAX_SOCKETS];
+static int accepted_sessions = 0;
+static int peak_sessions = 0;
+
+static host_socket_t *find_socket(int sockfd)
+{
+    int i = sockfd - HOST_FIRST_SOCKFD;
+
+    if (i < 0 || i >= HOST_MAX_SOCKETS || !sockets[i].used) return NULL;
+    return &sockets[i];
+}
+
+static int open_sockets(void)
+{
+    int n = 0;
+
+    for (int i = 0; i < HOST_MAX_SOCKETS; i++) {
+        if (sockets[i].used) n++;
+    }
+    return n;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    server_config = *config;
+    server_started = true;
+    uri_count = 0;
+    *handle = &server_config;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    if (uri_count >= server_config.max_uri_handlers || uri_count >= HOST_MAX_URIS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < uri_count; i++) {
+        if (uris[i].method == uri_handler->method && strcmp(uris[i].uri, uri_handler->uri) == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    uris[uri_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+int host_getpeername(int s, struct sockaddr *name, socklen_t *namelen)
+{
+    host_socket_t *sock = find_socket(s);
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+
+    if (sock == NULL) return -1;
+
+    addr.sin_addr.s_addr = sock->peer_addr;
+    memcpy(name, &addr, *namelen < sizeof(addr) ? *namelen : sizeof(addr));
+    *namelen = sizeof(addr);
+    return 0;
+}
+
+int host_close(int s)
+{
+    host_socket_t *sock = find_socket(s);
+
+    if (sock == NULL) return -1;
+    if (sock->accepted) accepted_sessions--;
+    sock->used = false;
+    sock->accepted = false;
+    return 0;
+}
+
+static void close_session(int sockfd)
+{
+    // Like httpd, close_fn owns closing the socket when it is set
+    if (server_config.close_fn) {
+        server_config.close_fn(&server_config, sockfd);
+    } else {
+        host_close(sockfd);
+    }
+}
+
+int host_httpd_connect(uint32_t peer_addr)
+{
+    if (!server_started || open_sockets() >= server_config.max_open_sockets) {
+        return -1;
+    }
+
+    for (int i = 0; i < HOST_MAX_SOCKETS; i++) {
+        if (!sockets[i].used) {
+            int sockfd = HOST_FIRST_SOCKFD + i;
+
+            sockets[i].used = true;
+            sockets[i].peer_addr = peer_addr;
+
+            // httpd runs close_fn on a session open_fn refused as well
+            if (server_config.open_fn && server_config.open_fn(&server_config, sockfd) != ESP_OK) {
+                close_session(sockfd);
+                return -1;
+            }
+
+            sockets[i].accepted = true;
+            if (++accepted_sessions > peak_sessions) peak_sessions = accepted_sessions;
+            return sockfd;
+        }
+    }
+
+    return -1;
+}
+
+void host_httpd_disconnect(int sockfd)
+{
+    if (find_socket(sockfd) != NULL) {
+        close_session(sockfd);
+    }
+}
+
+int host_httpd_peak_sessions(void)
+{
+    return peak_sessions;
+}
+
+static const httpd_uri_t *find_uri(httpd_method_t method, const char *uri)
+{
+    size_t path_len = strcspn(uri, "?");
+
+    for (int i = 0; i < uri_count; i++) {
+        if (uris[i].method == method && strlen(uris[i].uri) == path_len &&
+            strncmp(uris[i].uri, uri, path_len) == 0) {
+            return &uris[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t host_httpd_request(int sockfd, const host_request_t *request, host_response_t *response)
+{
+    httpd_req_t req = { 0 };
+    host_req_ctx_t ctx = {
+        .in = request,
+        .out = response,
+        .sockfd = sockfd,
+        .timeouts_left = request->timeouts,
+    };
+
+    memset(response, 0, sizeof(*response));
+
+    if (find_socket(sockfd) == NULL) {
+        response->closed = true;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const httpd_uri_t *uri = find_uri(request->method, request->uri);
+    if (uri == NULL) {
+        response->status = 404;
+        return ESP_OK;
+    }
+
+    req.handle = &server_config;
+    req.method = request->method;
+    strncpy((char *)req.uri, request->uri, HTTPD_MAX_URI_LEN);
+    req.content_len = request->body_len;
+    req.aux = &ctx;
+    req.user_ctx = uri->user_ctx;
+
+    response->handler_ret = uri->handler(&req);
+    if (response->handler_ret != ESP_OK) {
+        close_session(sockfd);
+        response->closed = true;
+    }
+
+    return ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    host_req_ctx_t *ctx = r->aux;
+    const host_request_t *in = ctx->in;
+    size_t end = in->truncate_at ? in->truncate_at : in->body_len;
+
+    if (ctx->offset >= end) {
+        return ctx->offset >= in->body_len ? 0 : HTTPD_SOCK_ERR_FAIL;
+    }
+
+    // Timeouts are spread so that some land between fragments of the body
+    if (ctx->timeouts_left > 0 && ctx->fragments % 2 == 1) {
+        ctx->timeouts_left--;
+        ctx->fragments++;
+        return HTTPD_SOCK_ERR_TIMEOUT;
+    }
+    ctx->fragments++;
+
+    size_t n = end - ctx->offset;
+    if (n > buf_len) n = buf_len;
+    if (in->fragment && n > in->fragment) n = in->fragment;
+
+    memcpy(buf, in->body + ctx->offset, n);
+    ctx->offset += n;
+    return (int)n;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return ((host_req_ctx_t *)r->aux)->sockfd;
+}
+
+static const char *find_header(httpd_req_t *r, const char *field)
+{
+    const char *const *headers = ((host_req_ctx_t *)r->aux)->in->headers;
+
+    for (int i = 0; headers && headers[i]; i += 2) {
+        if (strcasecmp(headers[i], field) == 0) return headers[i + 1];
+    }
+    return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    const char *value = find_header(r, field);
+    return value ? strlen(value) : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    const char *value = find_header(r, field);
+
+    if (value == NULL) return ESP_ERR_NOT_FOUND;
+
+    snprintf(val, val_size, "%s", value);
+    return strlen(value) < val_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *query = strchr(r->uri, '?');
+
+    if (query == NULL) return ESP_ERR_NOT_FOUND;
+
+    snprintf(buf, buf_len, "%s", query + 1);
+    return strlen(query + 1) < buf_len ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+
+    while (*qry) {
+        size_t pair_len = strcspn(qry, "&");
+
+        if (pair_len > key_len && strncmp(qry, key, key_len) == 0 && qry[key_len] == '=') {
+            size_t value_len = pair_len - key_len - 1;
+
+            snprintf(val, val_size, "%.*s", (int)value_len, qry + key_len + 1);
+            return value_len < val_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+        }
+
+        qry += pair_len;
+        if (*qry == '&') qry++;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+static void capture_body(httpd_req_t *r, const char *buf, size_t len)
+{
+    host_req_ctx_t *ctx = r->aux;
+    host_response_t *out = ctx->out;
+
+    if (!ctx->status_set) out->status = 200;
+    if (len > HOST_RESPONSE_MAX) len = HOST_RESPONSE_MAX;
+
+    memcpy(out->body, buf, len);
+    out->body[len] = '\0';
+    out->body_len = len;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    capture_body(r, buf, buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *r, const char *str)
+{
+    capture_body(r, str, strlen(str));
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    host_req_ctx_t *ctx = r->aux;
+
+    ctx->out->status = atoi(status);
+    ctx->status_set = true;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    host_req_ctx_t *ctx = r->aux;
+
+    if (strcasecmp(field, "Retry-After") == 0) {
+        snprintf(ctx->out->retry_after, sizeof(ctx->out->retry_after), "%s", value);
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    static const int codes[] = {
+        [HTTPD_400_BAD_REQUEST] = 400,
+        [HTTPD_404_NOT_FOUND] = 404,
+        [HTTPD_408_REQ_TIMEOUT] = 408,
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = 500,
+    };
+
+    host_req_ctx_t *ctx = req->aux;
+
+    ctx->out->status = codes[error];
+    ctx->status_set = true;
+    capture_body(req, msg, strlen(msg));
+    return ESP_OK;
+}
@@ -0,0 +1,408 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "host_harness.h"
+
+#define NVS_MAX_ENTRIES     32
+#define NVS_MAX_VALUE       2048
+
+typedef enum {
+    NVS_TYPE_U8,
+    NVS_TYPE_U16,
+    NVS_TYPE_U32,
+    NVS_TYPE_U64,
+    NVS_TYPE_BLOB,
+} nvs_type_t;
+
+typedef struct {
+    bool used;
+    char key[16];
+    nvs_type_t type;
+    size_t length;
+    uint8_t value[NVS_MAX_VALUE];
+} nvs_entry_t;
+
+static pthread_mutex_t critical_lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_entry_t nvs_entries[NVS_MAX_ENTRIES];
+static unsigned nvs_fail_nth = 0;
+static unsigned nvs_writes = 0;
+static esp_err_t nvs_fail_err = ESP_OK;
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+void host_abort_on_error(esp_err_t err, const char *expr, const char *file, int line)
+{
+    if (err != ESP_OK) {
+        fprintf(stderr, "%s:%d: %s failed: %s\n", file, line, expr, esp_err_to_name(err));
+        abort();
+    }
+}
+
+// ESPLANT_HOST_LOG=E|W|I|D picks the most verbose level printed, default silent
+void host_log(char level, const char *tag, const char *fmt, ...)
+{
+    static const char levels[] = "EWID";
+    static int max_level = -2;
+    va_list args;
+
+    if (max_level == -2) {
+        const char *env = getenv("ESPLANT_HOST_LOG");
+        const char *pos = env && *env ? strchr(levels, env[0]) : NULL;
+        max_level = pos ? (int)(pos - levels) : -1;
+    }
+
+    const char *pos = strchr(levels, level);
+    if (pos == NULL || (int)(pos - levels) > max_level) return;
+
+    fprintf(stderr, "%c (%s) ", level, tag);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void host_critical_enter(void)
+{
+    pthread_mutex_lock(&critical_lock);
+}
+
+void host_critical_exit(void)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = { .tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    static EventBits_t bits;
+    return &bits;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    return *(EventBits_t *)group |= bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks)
+{
+    return *(EventBits_t *)group;
+}
+
+/* NVS, one namespace kept in memory */
+
+void host_nvs_fail_every(unsigned nth, esp_err_t err)
+{
+    nvs_fail_nth = nth;
+    nvs_fail_err = err;
+    nvs_writes = 0;
+}
+
+static esp_err_t injected_fault(void)
+{
+    if (nvs_fail_nth && ++nvs_writes % nvs_fail_nth == 0) return nvs_fail_err;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    memset(nvs_entries, 0, sizeof(nvs_entries));
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    *handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return injected_fault();
+}
+
+static nvs_entry_t *find_entry(const char *key)
+{
+    for (int i = 0; i < NVS_MAX_ENTRIES; i++) {
+        if (nvs_entries[i].used && strcmp(nvs_entries[i].key, key) == 0) return &nvs_entries[i];
+    }
+    return NULL;
+}
+
+static esp_err_t nvs_set(const char *key, nvs_type_t type, const void *value, size_t length)
+{
+    nvs_entry_t *entry = find_entry(key);
+    esp_err_t err = injected_fault();
+
+    if (err != ESP_OK) return err;
+    if (strlen(key) >= sizeof(entry->key) || length > NVS_MAX_VALUE) return ESP_ERR_INVALID_ARG;
+
+    for (int i = 0; entry == NULL && i < NVS_MAX_ENTRIES; i++) {
+        if (!nvs_entries[i].used) entry = &nvs_entries[i];
+    }
+    if (entry == NULL) return ESP_ERR_NVS_NO_FREE_PAGES;
+
+    entry->used = true;
+    strcpy(entry->key, key);
+    entry->type = type;
+    entry->length = length;
+    memcpy(entry->value, value, length);
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get(const char *key, nvs_type_t type, void *value, size_t length)
+{
+    nvs_entry_t *entry = find_entry(key);
+
+    if (entry == NULL || entry->type != type) return ESP_ERR_NVS_NOT_FOUND;
+
+    memcpy(value, entry->value, length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvs_set(key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value)
+{
+    return nvs_set(key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set(key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char *key, uint64_t value)
+{
+    return nvs_set(key, NVS_TYPE_U64, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value)
+{
+    return nvs_get(key, NVS_TYPE_U8, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *value)
+{
+    return nvs_get(key, NVS_TYPE_U16, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    return nvs_get(key, NVS_TYPE_U32, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char *key, uint64_t *value)
+{
+    return nvs_get(key, NVS_TYPE_U64, value, sizeof(*value));
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    nvs_entry_t *entry = find_entry(key);
+
+    if (entry == NULL || entry->type != NVS_TYPE_BLOB) return ESP_ERR_NVS_NOT_FOUND;
+
+    if (value == NULL) {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length) return ESP_ERR_NVS_INVALID_LENGTH;
+
+    memcpy(value, entry->value, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+/* HTTP client and TLS, there is no network on the host */
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    static int client;
+    return &client;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return 0;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return 0;
+}
+
+esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t h, int *esp_tls_code, int *esp_tls_flags)
+{
+    return ESP_OK;
+}
+
+/* Wi-Fi, netif, events and mDNS */
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+void *esp_netif_create_default_wifi_sta(void)
+{
+    return NULL;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id, esp_event_handler_t handler,
+                                              void *arg, esp_event_handler_instance_t *instance)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t iface, wifi_config_t *conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_hostname_set(const char *hostname)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_instance_name_set(const char *instance_name)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_service_add(const char *instance_name, const char *service_type, const char *proto, uint16_t port,
+                           mdns_txt_item_t txt[], size_t num_items)
+{
+    return ESP_OK;
+}
+
+esp_err_t mdns_service_txt_item_set(const char *service_type, const char *proto, const char *key, const char *value)
+{
+    return ESP_OK;
+}
+
+/* System */
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    static const uint8_t host_mac[6] = { 0x02, 0x00, 0x00, 0x12, 0x34, 0x56 };
+    memcpy(mac, host_mac, sizeof(host_mac));
+    return ESP_OK;
+}
+
+uint32_t esp_random(void)
+{
+    static uint32_t state = 0x2545f491;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    static const esp_app_desc_t desc = { .version = "host", .project_name = "annaffiatoio_pianta" };
+    return &desc;
+}
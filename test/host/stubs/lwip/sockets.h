@@ -0,0 +1,10 @@
+#pragma once
+#include "../host_idf.h"
+
+// lwIP maps the BSD names onto its own calls the same way; here they resolve
+// to the fake connections owned by host_httpd.c
+int host_getpeername(int s, struct sockaddr *name, socklen_t *namelen);
+int host_close(int s);
+
+#define getpeername(s, name, namelen) host_getpeername(s, name, namelen)
+#define close(s)                      host_close(s)
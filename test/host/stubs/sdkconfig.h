@@ -0,0 +1,45 @@
+#pragma once
+
+// Kconfig defaults of the components under test; the CMake targets override
+// single values with -D where a driver needs a different configuration
+
+#define CONFIG_ESP_WIFI_SSID                "host"
+#define CONFIG_ESP_WIFI_PASSWORD            "host"
+#define CONFIG_ESP_WIFI_CHANNEL             1
+#define CONFIG_ESP_MAX_STA_CONN             4
+#define CONFIG_ESP_MAXIMUM_RETRY            5
+
+#define CONFIG_ESPLANT_MDNS_HOSTNAME        "esplant"
+#define CONFIG_ESPLANT_MDNS_INSTANCE        "ESPlant"
+
+#ifndef CONFIG_HTTP_MAX_IN_FLIGHT
+#define CONFIG_HTTP_MAX_IN_FLIGHT           4
+#endif
+#ifndef CONFIG_HTTP_RATE_LIMIT_CLIENTS
+#define CONFIG_HTTP_RATE_LIMIT_CLIENTS      8
+#endif
+#ifndef CONFIG_HTTP_READ_RATE_PER_MIN
+#define CONFIG_HTTP_READ_RATE_PER_MIN       120
+#endif
+#ifndef CONFIG_HTTP_READ_BURST
+#define CONFIG_HTTP_READ_BURST              20
+#endif
+#ifndef CONFIG_HTTP_WRITE_RATE_PER_MIN
+#define CONFIG_HTTP_WRITE_RATE_PER_MIN      2
+#endif
+#ifndef CONFIG_HTTP_WRITE_BURST
+#define CONFIG_HTTP_WRITE_BURST             3
+#endif
+#ifndef CONFIG_HTTP_OTA_RATE_PER_MIN
+#define CONFIG_HTTP_OTA_RATE_PER_MIN        30
+#endif
+#ifndef CONFIG_HTTP_OTA_BURST
+#define CONFIG_HTTP_OTA_BURST               10
+#endif
+
+#define CONFIG_WATER_CATCH_UP_WITHIN        1
+#define CONFIG_WATER_CATCH_UP_MAX_LATE_MIN  60
+#define CONFIG_WATER_ON_TIME_GRACE_S        5
+#define CONFIG_WATER_LATENESS_HISTORY       64
+#define CONFIG_WATER_FLOW_ML_PER_MIN        1000
+#define CONFIG_WATER_STATS_CHECKPOINT_MIN   60